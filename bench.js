@@ -0,0 +1,153 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+// Benchmark runner. Runs the native benchmark against the simulated display
+// for each display series and transfer mode, then the same transfers through
+// the JS binding, and prints everything as one JSON document.
+//
+//   node bench.js [--out results.json] [--compare previous.json]
+
+"use strict";
+
+var child_process = require('child_process');
+var fs = require('fs');
+var path = require('path');
+
+var CONFIGS = [
+    { name: '3900',           args: [ '--series', '3900' ] },
+    { name: '3900-burst8',    args: [ '--series', '3900', '--burst', '8', '--fifo', '8' ] },
+    { name: '3900-csstrobe8', args: [ '--series', '3900', '--burst', '8', '--fifo', '8', '--cs-strobe' ] },
+    { name: '7000',           args: [ '--series', '7000' ] },
+    { name: '3900-spi0',      args: [ '--series', '3900', '--spi0' ] },
+    { name: '3900-spi0-cs8',  args: [ '--series', '3900', '--spi0', '--cs-strobe', '--burst', '8', '--fifo', '8' ] },
+    { name: '7000-spi0',      args: [ '--series', '7000', '--spi0' ] }
+];
+
+var SIZES = [ 8, 64, 512, 4104 ];
+
+function findBench() {
+    var candidates = [ 'build/Release/bench', 'build/Debug/bench' ];
+    for (var i = 0; i < candidates.length; i++) {
+        var file = path.join(__dirname, candidates[i]);
+        if (fs.existsSync(file))
+            return file;
+    }
+    throw new Error('bench binary not found, run node-gyp rebuild first');
+}
+
+function runNative() {
+    var bench = findBench();
+    return CONFIGS.map(function(config) {
+        var output = child_process.execFileSync(bench, config.args.concat([ '--sizes', SIZES.join(',') ]));
+        var result = JSON.parse(output);
+        result.name = config.name;
+        return result;
+    });
+}
+
+// Same transfers, but through spi.write() so the JS/native crossing and the
+// argument handling are part of the measurement.
+function runBinding() {
+    var SPI = require('./spi');
+    var spi = new SPI.Spi('sim', { 'transport': 'sim', 'wrPin': 23, 'rdyPin': 24,
+                                   'maxSpeed': 4000000 });
+    spi.open();
+
+    var results = SIZES.map(function(size) {
+        var buf = new Buffer(size);
+        var iterations = Math.max(1, Math.floor(65536 / size));
+        var cpu = process.cpuUsage();
+        var start = process.hrtime();
+
+        for (var i = 0; i < iterations; i++)
+            spi.write(buf);
+
+        var elapsed = process.hrtime(start);
+        cpu = process.cpuUsage(cpu);
+        var seconds = elapsed[0] + elapsed[1] / 1e9;
+
+        return {
+            bench: 'write',
+            size: size,
+            iterations: iterations,
+            bytes: size * iterations,
+            seconds: seconds,
+            cpuSeconds: (cpu.user + cpu.system) / 1e6,
+            bytesPerSec: size * iterations / seconds,
+            overruns: spi.simulator().overruns
+        };
+    });
+
+    spi.close();
+    return { name: 'binding-3900', results: results };
+}
+
+// Flags every result that got more than 10% slower than in the previous run
+function compare(current, previous) {
+    var regressions = [];
+    current.runs.forEach(function(run) {
+        var old = previous.runs.filter(function(r) { return r.name == run.name; })[0];
+        if (!old)
+            return;
+        run.results.forEach(function(result) {
+            var match = old.results.filter(function(r) {
+                return r.bench == result.bench && r.size == result.size;
+            })[0];
+            if (match && result.bytesPerSec < match.bytesPerSec * 0.9) {
+                regressions.push({ run: run.name, bench: result.bench, size: result.size,
+                                   bytesPerSec: result.bytesPerSec,
+                                   previous: match.bytesPerSec });
+            }
+        });
+    });
+    return regressions;
+}
+
+function main(argv) {
+    var out = null, previous = null;
+    for (var i = 0; i < argv.length; i++) {
+        if (argv[i] == '--out')
+            out = argv[++i];
+        else if (argv[i] == '--compare')
+            previous = JSON.parse(fs.readFileSync(argv[++i]));
+    }
+
+    var report = {
+        version: require('./package.json').version,
+        node: process.version,
+        arch: process.arch,
+        date: new Date().toISOString(),
+        runs: runNative()
+    };
+
+    try {
+        report.runs.push(runBinding());
+    } catch (e) {
+        console.error('Skipping binding benchmark: ' + e.message);
+    }
+
+    if (previous)
+        report.regressions = compare(report, previous);
+
+    var json = JSON.stringify(report, null, 2);
+    if (out)
+        fs.writeFileSync(out, json + '\n');
+    console.log(json);
+
+    process.exitCode = (report.regressions && report.regressions.length) ? 1 : 0;
+}
+
+main(process.argv.slice(2));
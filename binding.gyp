@@ -2,7 +2,43 @@
   "targets": [
     {
       "target_name": "_spi",
-      "sources": [ "src/spi_binding.cc" ]
+      "defines": [ "NAPI_VERSION=6" ],
+      "sources": [ "src/spi_binding.cc",
+                   "src/spi_device.cc",
+                   "src/delay.cc",
+                   "src/transport.cc",
+                   "src/spi0.cc",
+                   "src/gpio_map.cc",
+                   "src/sim_transport.cc",
+                   "src/framebuffer.cc",
+                   "src/compositor.cc",
+                   "src/ntk_encoder.cc",
+                   "src/pack.cc",
+                   "src/dither.cc",
+                   "src/font.cc",
+                   "src/trace.cc",
+                   "src/scheduler.cc",
+                   "src/autotune.cc",
+                   "src/command_queue.cc" ]
+    },
+    {
+      "target_name": "bench",
+      "type": "executable",
+      "sources": [ "src/bench.cc",
+                   "src/spi_device.cc",
+                   "src/delay.cc",
+                   "src/transport.cc",
+                   "src/spi0.cc",
+                   "src/gpio_map.cc",
+                   "src/sim_transport.cc",
+                   "src/framebuffer.cc",
+                   "src/compositor.cc",
+                   "src/ntk_encoder.cc",
+                   "src/pack.cc",
+                   "src/dither.cc",
+                   "src/trace.cc",
+                   "src/scheduler.cc",
+                   "src/command_queue.cc" ]
     }
   ]
 }
@@ -16,6 +16,9 @@
 
 "use strict";
 
+var fs = require('fs');
+var stream = require('stream');
+var util = require('util');
 var _spi = require('bindings')('_spi.node');
 
 // Consistance with docs
@@ -56,6 +59,8 @@ var Spi = function(device, options, callback) {
     }
 
     this.device = device;
+    this._flushCallbacks = [];
+    this._flushScheduled = false;
 
     isFunction(callback) && callback(this); // TODO: Update once open is async;
 }
@@ -69,13 +74,13 @@ Spi.prototype.close = function() {
 }
 
 Spi.prototype.write = function(buf, callback) {
-    this._spi.transfer(buf, new Buffer(buf.length));
+    this._spi.transfer(buf, null);
 
     isFunction(callback) && callback(this, buf); // TODO: Update once open is async;
 }
 
 Spi.prototype.read = function(buf, callback) {
-    this._spi.transfer(new Buffer(buf.length), buf);
+    this._spi.transfer(null, buf);
 
     isFunction(callback) && callback(this, buf); // TODO: Update once open is async;
 }
@@ -87,6 +92,349 @@ Spi.prototype.transfer = function(txbuf, rxbuf, callback) {
     isFunction(callback) && callback(this, rxbuf); // TODO: Update once open is async;
 }
 
+// Writes several buffers back to back as one transfer, without joining them
+Spi.prototype.transferv = function(bufs, callback) {
+    this._spi.transferv(bufs);
+
+    isFunction(callback) && callback(this, bufs);
+}
+
+// Runs the transfer on the libuv thread pool so the event loop keeps
+// running while the display is being fed. Calls callback(err, result) or,
+// without a callback, returns a Promise that resolves to result.
+function transferAsync(spi, txbuf, rxbuf, result, callback) {
+    if (isFunction(callback)) {
+        spi._spi.transfer(txbuf, rxbuf, function(err) {
+            callback(err, result);
+        });
+        return;
+    }
+
+    return new Promise(function(resolve, reject) {
+        spi._spi.transfer(txbuf, rxbuf, function(err) {
+            err ? reject(err) : resolve(result);
+        });
+    });
+}
+
+Spi.prototype.writeAsync = function(buf, callback) {
+    return transferAsync(this, buf, null, buf, callback);
+}
+
+Spi.prototype.readAsync = function(buf, callback) {
+    return transferAsync(this, null, buf, buf, callback);
+}
+
+// Queues a small command or text write. Everything queued in the same tick
+// is sent as one transfer on the thread pool, without the redundant state
+// commands. callback(err, bytes) is called once the batch is out.
+Spi.prototype.queue = function(buf, callback) {
+    this._spi.queue(buf);
+    isFunction(callback) && this._flushCallbacks.push(callback);
+
+    if (!this._flushScheduled) {
+        this._flushScheduled = true;
+        var spi = this;
+        process.nextTick(function() {
+            spi._flushScheduled && spi.flush();
+        });
+    }
+    return this;
+}
+
+// Sends the queue right away instead of at the end of the tick
+Spi.prototype.flush = function(callback) {
+    var callbacks = this._flushCallbacks;
+    this._flushCallbacks = [];
+    this._flushScheduled = false;
+    isFunction(callback) && callbacks.push(callback);
+
+    var done = function(err, bytes) {
+        for (var i = 0; i < callbacks.length; i++) {
+            callbacks[i](err, bytes);
+        }
+    };
+
+    try {
+        this._spi.flush(done);
+    } catch (err) {
+        done(err);
+    }
+}
+
+Spi.prototype.transfervAsync = function(bufs, callback) {
+    var spi = this;
+    if (isFunction(callback)) {
+        spi._spi.transferv(bufs, function(err) {
+            callback(err, bufs);
+        });
+        return;
+    }
+
+    return new Promise(function(resolve, reject) {
+        spi._spi.transferv(bufs, function(err) {
+            err ? reject(err) : resolve(bufs);
+        });
+    });
+}
+
+Spi.prototype.transferAsync = function(txbuf, rxbuf, callback) {
+    return transferAsync(this, txbuf, rxbuf, rxbuf, callback);
+}
+
+// A Writable over the device. A write only completes once the display took
+// every byte of it over RDY, so write() returns false while highWaterMark
+// bytes or more are not acknowledged yet. Chunks written while a transfer
+// runs go out together as the next transferv() on the thread pool.
+function SpiWriteStream(spi, options) {
+    options = options || {};
+    stream.Writable.call(this, {
+        highWaterMark: options.highWaterMark || 4096,
+        defaultEncoding: options.defaultEncoding
+    });
+    this.spi = spi;
+    this.bytesWritten = 0;
+}
+util.inherits(SpiWriteStream, stream.Writable);
+
+SpiWriteStream.prototype._write = function(chunk, encoding, callback) {
+    this._writev([ { chunk: chunk, encoding: encoding } ], callback);
+}
+
+SpiWriteStream.prototype._writev = function(chunks, callback) {
+    var self = this;
+    var bufs = chunks.map(function(entry) { return entry.chunk; });
+
+    try {
+        this.spi._spi.transferv(bufs, function(err, bytes) {
+            if (!err)
+                self.bytesWritten += bytes;
+            callback(err);
+        });
+    } catch (err) {
+        callback(err);
+    }
+}
+
+// options: { highWaterMark: bytes, defaultEncoding }
+Spi.prototype.createWriteStream = function(options) {
+    return new SpiWriteStream(this, options);
+}
+
+// options: { depth: frames, priority: SCHED_FIFO priority, cpu: core,
+//            buffers: present() back buffers, 2 or 3 }
+Spi.prototype.engineStart = function(options) {
+    options = options || {};
+    return this._spi.engineStart(options.depth || 16,
+                                 options.priority || 0,
+                                 typeof(options.cpu) != 'undefined' ? options.cpu : -1,
+                                 options.buffers || 2);
+}
+
+Spi.prototype.engineStop = function() {
+    return this._spi.engineStop();
+}
+
+Spi.prototype.submit = function(buf) {
+    return this._spi.submit(buf);
+}
+
+Spi.prototype.present = function(frame) {
+    this._spi.present(frame);
+    return this;
+}
+
+Spi.prototype.engineStatus = function() {
+    return this._spi.engineStatus();
+}
+
+Spi.prototype.framebuffer = function(width, height) {
+    this._spi.framebuffer(width, height);
+    return this;
+}
+
+// Sends the parts of frame that changed since the last commit. Returns the
+// bytes sent, or calls callback(err, bytes) from the thread pool.
+Spi.prototype.commit = function(frame, callback) {
+    if (isFunction(callback)) {
+        return this._spi.commit(frame, callback);
+    }
+    return this._spi.commit(frame);
+}
+
+Spi.prototype.invalidate = function() {
+    this._spi.invalidate();
+    return this;
+}
+
+var BLEND = { 'or': _spi.BLEND_OR, 'and': _spi.BLEND_AND, 'xor': _spi.BLEND_XOR };
+
+// options: { x, y, z, blend: 'or' | 'and' | 'xor', bitmap: Buffer, visible,
+//            clip: [x, y, width, height], scroll, width }
+Spi.prototype.addLayer = function(width, height, options) {
+    options = options || {};
+    var blend = BLEND[options.blend || 'or'];
+    if (typeof(blend) == 'undefined')
+        throw new TypeError('Unknown blend mode: ' + options.blend);
+
+    var id = this._spi.addLayer(width, height, options.z || 0, blend);
+    this.layer(id, options);
+    return id;
+}
+
+// Same options as addLayer(); x and y go together
+Spi.prototype.layer = function(id, options) {
+    var native = {};
+    for (var key in options) {
+        native[key] = options[key];
+    }
+    if (typeof(options.blend) != 'undefined') {
+        native.blend = BLEND[options.blend];
+        if (typeof(native.blend) == 'undefined')
+            throw new TypeError('Unknown blend mode: ' + options.blend);
+    }
+
+    if (options.bitmap)
+        this._spi.layerBitmap(id, options.bitmap);
+    if (typeof(options.x) != 'undefined' || typeof(options.y) != 'undefined')
+        this._spi.moveLayer(id, options.x || 0, options.y || 0);
+    this._spi.layer(id, native);
+    return this;
+}
+
+Spi.prototype.moveLayer = function(id, x, y) {
+    this._spi.moveLayer(id, x, y);
+    return this;
+}
+
+Spi.prototype.removeLayer = function(id) {
+    this._spi.removeLayer(id);
+    return this;
+}
+
+Spi.prototype.compose = function(frame) {
+    if (frame)
+        return this._spi.compose(frame);
+    return this._spi.compose();
+}
+
+Spi.prototype.commitLayers = function(callback) {
+    if (isFunction(callback))
+        return this._spi.commitLayers(callback);
+    return this._spi.commitLayers();
+}
+
+Spi.prototype.address = function(x, y) {
+    return this._spi.address(x, y);
+}
+
+// Without out, returns a new Buffer holding the command. With out, encodes at
+// offset and returns the length.
+Spi.prototype.encodeBitImage = function(address, data, out, offset) {
+    if (typeof(out) == 'undefined')
+        return this._spi.encodeBitImage(address, data);
+    return this._spi.encodeBitImage(address, data, out, offset || 0);
+}
+
+Spi.prototype.encodeWindow = function(x, y, width, height, data, out, offset) {
+    if (typeof(out) == 'undefined')
+        return this._spi.encodeWindow(x, y, width, height, data);
+    return this._spi.encodeWindow(x, y, width, height, data, out, offset || 0);
+}
+
+Spi.prototype.writeBitImage = function(address, data) {
+    return this._spi.writeBitImage(address, data);
+}
+
+Spi.prototype.writeWindow = function(x, y, width, height, data) {
+    return this._spi.writeWindow(x, y, width, height, data);
+}
+
+var PACK_FORMAT = { 'gray': 1, 'rgba': 4 };
+
+// options: { format: 'rgba' | 'gray', stride: bytes per row, threshold: 0-255,
+//            frame: Buffer, x, y }
+Spi.prototype.pack = function(src, width, height, options) {
+    options = options || {};
+    var format = PACK_FORMAT[options.format || 'rgba'];
+    if (!format)
+        throw new TypeError('Unknown pixel format: ' + options.format);
+    var stride = options.stride || width * format;
+    var threshold = typeof(options.threshold) != 'undefined' ? options.threshold : 128;
+
+    if (options.frame)
+        return this._spi.pack(src, width, height, format, stride, threshold,
+                              options.frame, options.x || 0, options.y || 0);
+    return this._spi.pack(src, width, height, format, stride, threshold);
+}
+
+var DITHER = { 'bayer': 0, 'floyd-steinberg': 1 };
+
+// options: { method: 'bayer' | 'floyd-steinberg', format, stride, frame, x, y }
+Spi.prototype.dither = function(src, width, height, options) {
+    options = options || {};
+    var format = PACK_FORMAT[options.format || 'rgba'];
+    if (!format)
+        throw new TypeError('Unknown pixel format: ' + options.format);
+    var method = DITHER[options.method || 'bayer'];
+    if (typeof(method) == 'undefined')
+        throw new TypeError('Unknown dithering method: ' + options.method);
+    var stride = options.stride || width * format;
+
+    if (options.frame)
+        return this._spi.dither(src, width, height, format, stride, method,
+                                options.frame, options.x || 0, options.y || 0);
+    return this._spi.dither(src, width, height, format, stride, method);
+}
+
+var TEXT_MODE = { 'or': _spi.TEXT_OR, 'replace': _spi.TEXT_REPLACE, 'invert': _spi.TEXT_INVERT };
+
+// options: { font: id from loadFont(), mode: 'or' | 'replace' | 'invert',
+//            frame: Buffer, x, y }
+Spi.prototype.text = function(string, options) {
+    options = options || {};
+    var mode = TEXT_MODE[options.mode || 'or'];
+    if (typeof(mode) == 'undefined')
+        throw new TypeError('Unknown text mode: ' + options.mode);
+    var font = options.font || 0;
+
+    if (options.frame)
+        return this._spi.text(String(string), font, mode,
+                              options.frame, options.x || 0, options.y || 0);
+    return this._spi.text(String(string), font, mode);
+}
+
+Spi.prototype.stats = function() {
+    return this._spi.stats();
+}
+
+Spi.prototype.resetStats = function() {
+    this._spi.resetStats();
+    return this;
+}
+
+// Starts tracing into a ring of capacity events, 0 stops
+Spi.prototype.trace = function(capacity) {
+    this._spi.trace(capacity);
+    return this;
+}
+
+Spi.prototype.traceJson = function() {
+    return this._spi.traceJson();
+}
+
+// Writes the trace to filename, for chrome://tracing or ui.perfetto.dev
+Spi.prototype.traceExport = function(filename, callback) {
+    var json = this._spi.traceJson();
+    if (json === null) {
+        var err = new Error('Tracing is off');
+        if (isFunction(callback)) return callback(err);
+        throw err;
+    }
+    if (isFunction(callback)) return fs.writeFile(filename, json, callback);
+    fs.writeFileSync(filename, json);
+}
+
 Spi.prototype.mode = function(mode) {
     if (typeof(mode) != 'undefined')
 	if (mode == MODE['MODE_0'] || mode == MODE['MODE_1'] ||
@@ -200,6 +548,20 @@ Spi.prototype.rdyPin = function(pin) {
     return this._spi['rdyPin']();
 }
 
+Spi.prototype.dataPins = function(pins) {
+    if (typeof(pins) != 'undefined') {
+        this._spi['dataPins'](pins);
+    } else
+    return this._spi['dataPins']();
+}
+
+Spi.prototype.csStrobe = function(flag) {
+    if (typeof(flag) != 'undefined') {
+        this._spi['csStrobe'](flag);
+    } else
+    return this._spi['csStrobe']();
+}
+
 Spi.prototype.invertRdy = function(flag) {
     if (typeof(flag) != 'undefined') {
         this._spi['invertRdy'](flag);
@@ -214,8 +576,110 @@ Spi.prototype.bSeries = function(pin) {
     return this._spi['bSeries']();
 }
 
+Spi.prototype.burst = function(size) {
+    if (typeof(size) != 'undefined') {
+        this._spi['burst'](size);
+    } else
+    return this._spi['burst']();
+}
+Spi.prototype.settle = function(ns) {
+    if (typeof(ns) != 'undefined') {
+        this._spi['settle'](ns);
+    } else
+    return this._spi['settle']();
+}
+Spi.prototype.rdySpin = function(ns) {
+    if (typeof(ns) != 'undefined') {
+        this._spi['rdySpin'](ns);
+    } else
+    return this._spi['rdySpin']();
+}
+Spi.prototype.rdyTimeout = function(ms) {
+    if (typeof(ms) != 'undefined') {
+        this._spi['rdyTimeout'](ms);
+    } else
+    return this._spi['rdyTimeout']();
+}
+
+// The settings autotune() found, keyed by option name so that they can be
+// passed back to the constructor. What was measured with them is in the
+// non-enumerable 'measured' property.
+function tuneProfile(tuned) {
+    var profile = { maxSpeed: tuned.maxSpeed, settle: tuned.settle, delay: tuned.delay };
+    Object.defineProperty(profile, 'measured', { value: {
+        rdyLag: tuned.rdyLag,
+        rdyWait: tuned.rdyWait,
+        bytesPerSec: tuned.bytesPerSec,
+        trials: tuned.trials,
+        verified: tuned.verified
+    }});
+    return profile;
+}
+
+// options: { minSpeed, maxSpeed, bytes, trials, margin }
+Spi.prototype.autotune = function(options, callback) {
+    if (isFunction(options)) {
+        callback = options;
+        options = {};
+    }
+    options = options || {};
+    var minSpeed = options.minSpeed || 500000;
+    var maxSpeed = options.maxSpeed || 32000000;
+    var bytes = options.bytes || 512;
+    var trials = options.trials || 2;
+    var margin = typeof(options.margin) != 'undefined' ? options.margin : 50;
+
+    if (isFunction(callback)) {
+        this._spi.autotune(minSpeed, maxSpeed, bytes, trials, margin, function(err, tuned) {
+            callback(err, err ? undefined : tuneProfile(tuned));
+        });
+        return this;
+    }
+    return tuneProfile(this._spi.autotune(minSpeed, maxSpeed, bytes, trials, margin));
+}
+
+Spi.prototype.timing = function() {
+    return this._spi['timing']();
+}
+
+Spi.prototype.transport = function(name) {
+    if (typeof(name) != 'undefined') {
+        this._spi['transport'](name);
+    } else
+    return this._spi['transport']();
+}
+
+Spi.prototype.simulator = function(options) {
+    return this._spi['simulator'](options);
+}
+
+// Sends buffers[i] to displays[i] for all i at once, feeding one display
+// while the others are busy. Returns the bytes sent to each display, or
+// calls callback(err, bytes) from the thread pool.
+function interleave(displays, buffers, callback) {
+    var devices = displays.map(function(spi) { return spi._spi; });
+    if (isFunction(callback))
+        return _spi.interleave(devices, buffers, callback);
+    return _spi.interleave(devices, buffers);
+}
+
+// Loads a BDF font from a path or a Buffer. Returns {id, height, ascent,
+// glyphs}; pass id as the font option of text().
+function loadFont(font) {
+    if (!Buffer.isBuffer(font))
+        font = fs.readFileSync(font);
+    return _spi.loadFont(font);
+}
+
+function textWidth(string, font) {
+    return _spi.textWidth(font || 0, String(string));
+}
 
 module.exports.MODE = MODE;
 module.exports.CS = CS;
 module.exports.ORDER = ORDER;
 module.exports.Spi = Spi;
+module.exports.WriteStream = SpiWriteStream;
+module.exports.interleave = interleave;
+module.exports.loadFont = loadFont;
+module.exports.textWidth = textWidth;
@@ -0,0 +1,277 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "autotune.h"
+#include "delay.h"
+#include "ntk_encoder.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// Steps of the settle time binary search
+#define TUNE_SETTLE_STEPS 6
+
+struct TuneSettings {
+  uint32_t speed;
+  uint32_t settle_ns;
+  uint16_t delay;
+};
+
+class Tuner {
+    public:
+        Tuner(SpiDevice &device, const TuneOptions &options);
+
+        void apply(const TuneSettings &settings);
+        // All of options.trials pass with settings
+        bool passes(const TuneSettings &settings);
+
+        // Bring the display decoder back in step after a failed trial, at
+        // settings known to work
+        void recover(const TuneSettings &safe);
+
+        uint32_t m_trials;
+        uint64_t m_elapsed_ns;   // of the last trial
+        uint64_t m_rdy_waits;
+        uint64_t m_rdy_wait_ns;
+        size_t m_length;
+
+    private:
+        bool trial();
+
+        SpiDevice &m_device;
+        const TuneOptions &m_options;
+        uint32_t m_width;
+        uint32_t m_rows;
+        unsigned m_seed;
+        std::vector<uint8_t> m_image;
+        std::vector<uint8_t> m_encoded;
+};
+
+Tuner::Tuner(SpiDevice &device, const TuneOptions &options) :
+        m_trials(0),
+        m_elapsed_ns(0),
+        m_rdy_waits(0),
+        m_rdy_wait_ns(0),
+        m_length(0),
+        m_device(device),
+        m_options(options),
+        m_seed(1) {
+  // Whole columns on the left of the display, a single bit image write
+  m_rows = device.display_rows();
+  m_width = options.bytes / m_rows;
+  if (m_width < 1) { m_width = 1; }
+  if (m_width > device.display_width()) { m_width = device.display_width(); }
+  m_image.resize(m_width * m_rows);
+}
+
+void Tuner::apply(const TuneSettings &settings) {
+  pthread_mutex_lock(&m_device.m_lock);
+  m_device.m_max_speed = settings.speed;
+  m_device.m_settle_ns = settings.settle_ns;
+  m_device.m_delay = settings.delay;
+  pthread_mutex_unlock(&m_device.m_lock);
+}
+
+bool Tuner::passes(const TuneSettings &settings) {
+  apply(settings);
+  for (uint32_t i = 0; i < m_options.trials; i++) {
+    if (!trial()) { return false; }
+  }
+  return true;
+}
+
+// Writes a fresh random image, and checks it arrived whole when the
+// simulator can tell
+bool Tuner::trial() {
+  for (size_t i = 0; i < m_image.size(); i++) {
+    m_image[i] = rand_r(&m_seed);
+  }
+  bool bseries = m_device.bseries_commands();
+  m_encoded.resize(ntk_window_size(bseries, m_rows, m_width, m_rows));
+  m_length = ntk_window(&m_encoded[0], bseries, m_rows, 0, 0, m_width, m_rows, &m_image[0]);
+
+  SimTransport *sim = m_device.m_sim;
+  pthread_mutex_lock(&m_device.m_lock);
+  uint64_t overruns = sim ? sim->overruns() : 0;
+  pthread_mutex_unlock(&m_device.m_lock);
+  uint64_t waits = m_device.m_stats.rdy_wait_ns.count();
+  uint64_t wait_ns = m_device.m_stats.rdy_wait_ns.sum();
+
+  uint64_t start = delay_now_ns();
+  int ret = m_device.transfer((char *)&m_encoded[0], NULL, m_length);
+  m_elapsed_ns = delay_now_ns() - start;
+  m_rdy_waits = m_device.m_stats.rdy_wait_ns.count() - waits;
+  m_rdy_wait_ns = m_device.m_stats.rdy_wait_ns.sum() - wait_ns;
+  m_trials++;
+
+  if (ret < 0) { return false; }
+  if (!sim) { return true; }
+
+  pthread_mutex_lock(&m_device.m_lock);
+  bool whole = sim->overruns() == overruns;
+  const std::vector<uint8_t> &framebuffer = sim->framebuffer();
+  uint32_t sim_rows = sim->config().height / 8;
+  for (uint32_t x = 0; whole && x < m_width; x++) {
+    for (uint32_t row = 0; whole && row < m_rows; row++) {
+      size_t address = x * sim_rows + row;
+      whole = row < sim_rows && address < framebuffer.size() &&
+              framebuffer[address] == m_image[x * m_rows + row];
+    }
+  }
+  pthread_mutex_unlock(&m_device.m_lock);
+  return whole;
+}
+
+// A dropped or garbled byte can leave the display expecting image data.
+// Zeros are ignored between commands, so a frame worth of them ends any
+// image write; repeat until a trial passes again.
+void Tuner::recover(const TuneSettings &safe) {
+  apply(safe);
+  std::vector<char> zeros(m_device.display_width() * m_rows + 16, 0);
+  for (int attempt = 0; attempt < 16; attempt++) {
+    if (m_device.transfer(&zeros[0], NULL, zeros.size()) < 0) { return; }
+    if (trial()) { return; }
+  }
+}
+
+const char *autotune(SpiDevice &device, const TuneOptions &options, TuneResult &result) {
+  if (!device.m_open) { return "Device not opened"; }
+  if (!options.min_speed || options.max_speed < options.min_speed) {
+    return "Speed range is empty";
+  }
+
+  pthread_mutex_lock(&device.m_lock);
+  TuneSettings original = { device.m_max_speed, device.m_settle_ns, device.m_delay };
+  TuneSettings best = { options.min_speed, device.settle_ns(), device.m_delay };
+  uint32_t timeout_ms = device.m_rdy_timeout_ms;
+  if (!timeout_ms || timeout_ms > TUNE_RDY_TIMEOUT_MS) { device.m_rdy_timeout_ms = TUNE_RDY_TIMEOUT_MS; }
+  pthread_mutex_unlock(&device.m_lock);
+
+  Tuner tuner(device, options);
+  const char *error = NULL;
+
+  // How late the line moves, at the settings the device came with
+  int64_t lag = 0;
+  for (int i = 0; i < TUNE_LAG_SAMPLES && lag >= 0; i++) {
+    int64_t sample = device.measure_rdy_lag(4ULL * best.settle_ns);
+    lag = (sample < 0 || sample > lag) ? sample : lag;
+  }
+
+  if (lag < 0) {
+    error = SpiDevice::transfer_error(lag);
+  } else if (!tuner.passes(best)) {
+    error = "Link fails at the lowest speed";
+  } else {
+    // Clock: double while it passes, then halve the gap to the first
+    // speed that failed a few times
+    uint32_t failed = 0;
+    while (!failed && best.speed < options.max_speed) {
+      TuneSettings next = best;
+      next.speed = (best.speed > options.max_speed / 2) ? options.max_speed : best.speed * 2;
+      if (tuner.passes(next)) {
+        best = next;
+      } else {
+        failed = next.speed;
+        tuner.recover(best);
+      }
+    }
+    for (int step = 0; failed && step < 3; step++) {
+      TuneSettings next = best;
+      next.speed = best.speed + (failed - best.speed) / 2;
+      if (next.speed == best.speed) { break; }
+      if (tuner.passes(next)) {
+        best = next;
+      } else {
+        failed = next.speed;
+        tuner.recover(best);
+      }
+    }
+
+    // delay() after each segment: the shortest that passes, halving
+    while (best.delay) {
+      TuneSettings next = best;
+      next.delay = best.delay / 2;
+      if (!tuner.passes(next)) {
+        tuner.recover(best);
+        break;
+      }
+      best = next;
+    }
+
+    // Settle: on the simulator, binary search for the shortest that passes,
+    // but never below the lag; a byte that only gets through because the
+    // wire time covers a stale RDY read breaks on the first faster frame.
+    // On hardware, the lag is all there is to go by. The margin goes on top;
+    // 0 means the series default to the device, so 1ns is the least.
+    uint32_t low = device.m_sim ? std::min<uint64_t>(lag, best.settle_ns) : 0;
+    uint32_t high = device.m_sim ? best.settle_ns : lag;
+    for (int step = 0; device.m_sim && step < TUNE_SETTLE_STEPS && high - low > 1; step++) {
+      TuneSettings next = best;
+      next.settle_ns = low + (high - low) / 2;
+      if (tuner.passes(next)) {
+        high = next.settle_ns;
+      } else {
+        low = next.settle_ns;
+        tuner.recover(best);
+      }
+    }
+    uint64_t settle = (uint64_t)high * (100 + options.margin) / 100;
+    if ((device.m_sim || lag) && settle < best.settle_ns) {
+      TuneSettings next = best;
+      next.settle_ns = settle ? settle : 1;
+      if (tuner.passes(next)) {
+        best = next;
+      } else {
+        tuner.recover(best);
+      }
+    }
+
+    // Measure the result. The speed search stops right at the edge, so a
+    // setting that fails now backs the clock off by the margin, twice at most
+    for (int retry = 0; !tuner.passes(best); retry++) {
+      if (retry == 2 || best.speed == options.min_speed) {
+        error = "Link unstable at the settings found";
+        break;
+      }
+      best.speed = std::max<uint64_t>(options.min_speed, (uint64_t)best.speed * 100 / (100 + options.margin));
+      tuner.recover(best);
+    }
+  }
+
+  pthread_mutex_lock(&device.m_lock);
+  device.m_rdy_timeout_ms = timeout_ms;
+  pthread_mutex_unlock(&device.m_lock);
+
+  // The test images overwrote part of the display
+  device.invalidate();
+
+  if (error) {
+    tuner.apply(original);
+    return error;
+  }
+
+  tuner.apply(best);
+  result.max_speed = best.speed;
+  result.settle_ns = best.settle_ns;
+  result.delay = best.delay;
+  result.rdy_lag_ns = lag;
+  result.rdy_wait_ns = tuner.m_rdy_waits ? tuner.m_rdy_wait_ns / tuner.m_rdy_waits : 0;
+  result.bytes_per_sec = tuner.m_elapsed_ns ? tuner.m_length * 1e9 / tuner.m_elapsed_ns : 0;
+  result.trials = tuner.m_trials;
+  result.verified = device.m_sim != NULL;
+  return NULL;
+}
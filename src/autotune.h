@@ -0,0 +1,65 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "spi_device.h"
+
+// RDY timeout while tuning, so that a setting the display chokes on fails
+// fast instead of waiting out the device timeout
+#define TUNE_RDY_TIMEOUT_MS 50
+
+// Strobes timed for how late RDY/BUSY moves
+#define TUNE_LAG_SAMPLES 32
+
+struct TuneOptions {
+  uint32_t min_speed;    // Hz, the sweep starts here
+  uint32_t max_speed;    // and doubles up to here
+  uint32_t bytes;        // test pattern per trial
+  uint32_t trials;       // passes in a row a setting needs
+  uint32_t margin;       // percent added to the shortest settle that passed
+};
+
+// What autotune() settled on, and how the link performs with it
+struct TuneResult {
+  uint32_t max_speed;
+  uint32_t settle_ns;
+  uint16_t delay;
+  uint64_t rdy_lag_ns;     // longest strobe to RDY/BUSY moving, 0 if it never did
+  uint64_t rdy_wait_ns;    // mean RDY wait per byte
+  double bytes_per_sec;
+  uint32_t trials;         // trials run in total
+  bool verified;           // checked against the simulator framebuffer
+};
+
+// Finds the fastest settings the link delivers a test pattern with: first
+// the SPI clock, doubling from min_speed, then the delay() after each
+// segment, then the settle time after the strobe. Every trial writes a random
+// image to the left of the display. On the simulator a trial passes when the
+// decoded framebuffer holds the image and no byte was overrun, and the settle
+// time is the shortest one that passes, but no less than the measured RDY lag,
+// plus margin percent.
+//
+// Hardware cannot be read back through the 74HC595, so there a trial passes
+// when every byte got its RDY handshake in time, which says nothing about a
+// settle time too short. The settle time comes from the measured RDY lag
+// instead, plus margin percent, and stays as it is when the line was never
+// seen moving.
+//
+// The device must be open and the caller must have checked the transmit
+// engine is not running. The settings found
+// are left applied. Returns NULL, or an error with the settings restored.
+const char *autotune(SpiDevice &device, const TuneOptions &options, TuneResult &result);
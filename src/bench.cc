@@ -0,0 +1,418 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+// Native benchmark for the transfer path, run against the simulated display.
+// Prints one JSON document on stdout, see bench.js for the runner.
+//
+//   bench [--series 3900|7000] [--burst N] [--fifo N] [--cs-strobe]
+//         [--speed HZ] [--settle NS] [--sizes 8,64,512] [--bytes N]
+//         [--displays N] [--spi0]
+//
+// --spi0 sends through the userspace SPI0 FIFO driver and a simulated
+// controller instead of the spidev ioctl model.
+
+#include "spi_device.h"
+#include "ntk3900.h"
+#include "pack.h"
+#include "dither.h"
+#include "scheduler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+struct BenchOptions {
+  bool series_7000;
+  uint32_t burst;
+  uint32_t fifo;
+  bool cs_strobe;
+  bool spi0;
+  uint32_t speed;
+  uint32_t settle_ns;
+  std::vector<size_t> sizes;
+  size_t bytes;       // roughly how many bytes to push per size
+  uint32_t displays;  // for the interleave bench
+};
+
+struct BenchResult {
+  size_t size;
+  size_t iterations;
+  uint64_t bytes;
+  double seconds;
+  double cpu_seconds;
+  uint64_t overruns;
+  std::vector<uint64_t> latencies;   // ns between two bytes accepted
+};
+
+typedef bool (*BenchFunction)(const BenchOptions &options, size_t size, BenchResult &result);
+
+static double clock_seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t iterations_for(const BenchOptions &options, size_t size) {
+  size_t iterations = options.bytes / size;
+  return iterations ? iterations : 1;
+}
+
+static void setup_device(const BenchOptions &options, SpiDevice &device) {
+  device.set_transport("sim");
+  device.m_max_speed = options.speed;
+  device.m_wr_pin = 23;
+  device.m_rdy_pin = 24;
+  device.m_invert_rdy = options.series_7000;
+  device.m_bseries = options.series_7000;
+  device.m_cs_strobe = options.cs_strobe;
+  device.m_burst = options.burst;
+  device.m_settle_ns = options.settle_ns;
+
+  SimConfig config;
+  memset(&config, 0, sizeof(config));
+  config.fifo = options.fifo;
+  config.spi0 = options.spi0;
+  device.m_sim->configure(config);
+}
+
+// full_duplex_transfer() of random data, write only
+static bool bench_transfer(const BenchOptions &options, size_t size, BenchResult &result) {
+  SpiDevice device;
+  setup_device(options, device);
+  if (device.open("sim")) { return false; }
+
+  std::vector<char> data(size);
+  for (size_t i = 0; i < size; i++) { data[i] = rand(); }
+
+  std::vector<uint64_t> log;
+  log.reserve(size);
+  device.m_sim->record(&log);
+
+  result.iterations = iterations_for(options, size);
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (size_t i = 0; i < result.iterations; i++) {
+    log.clear();
+    if (device.transfer(&data[0], NULL, size) < 0) { return false; }
+    for (size_t j = 1; j < log.size(); j++) {
+      result.latencies.push_back(log[j] - log[j - 1]);
+    }
+  }
+
+  result.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+  result.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  result.bytes = (uint64_t)size * result.iterations;
+  result.overruns = device.m_sim->overruns();
+  return true;
+}
+
+// commit() of a 256x128 frame where size bytes changed in one block, four
+// byte rows high, like a line of text being redrawn. bytes counts what went
+// on the wire. Fails if the simulated display ends up different.
+static bool bench_commit(const BenchOptions &options, size_t size, BenchResult &result) {
+  SpiDevice device;
+  setup_device(options, device);
+  if (device.open("sim")) { return false; }
+  if (device.set_framebuffer(NTK_WIDTH, NTK_HEIGHT)) { return false; }
+
+  const size_t rows = NTK_HEIGHT / 8;
+  std::vector<uint8_t> frame(NTK_WIDTH * rows, 0);
+  device.commit(&frame[0]);
+  uint64_t start_bytes = device.m_sim->bytes();
+
+  size_t block_rows = 4;
+  size_t block_width = (size + block_rows - 1) / block_rows;
+  if (block_width > NTK_WIDTH) { block_width = NTK_WIDTH; }
+
+  result.iterations = iterations_for(options, size);
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (size_t i = 0; i < result.iterations; i++) {
+    size_t x = rand() % (NTK_WIDTH - block_width + 1);
+    size_t row = rand() % (rows - block_rows + 1);
+    for (size_t c = 0; c < block_width; c++) {
+      for (size_t r = 0; r < block_rows; r++) {
+        frame[(x + c) * rows + row + r] ^= (rand() % 255) + 1;
+      }
+    }
+    if (device.commit(&frame[0]) < 0) { return false; }
+  }
+
+  result.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+  result.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  result.bytes = device.m_sim->bytes() - start_bytes;
+  result.overruns = device.m_sim->overruns();
+  return device.m_sim->framebuffer() == frame;
+}
+
+// pack_threshold() of a 256x128 canvas, checked against a plain loop.
+// bytes counts the source bytes read.
+static bool bench_pack(const BenchOptions &options, int format, BenchResult &result) {
+  const size_t stride = NTK_WIDTH * format;
+  const size_t rows = NTK_HEIGHT / 8;
+  std::vector<uint8_t> canvas(stride * NTK_HEIGHT);
+  for (size_t i = 0; i < canvas.size(); i++) { canvas[i] = rand(); }
+  std::vector<uint8_t> frame(NTK_WIDTH * rows);
+
+  // Packing is much faster than the link, run it longer
+  result.iterations = iterations_for(options, frame.size()) * 64;
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (size_t i = 0; i < result.iterations; i++) {
+    pack_threshold(&frame[0], rows, &canvas[0], stride, format, NTK_WIDTH, NTK_HEIGHT, 128);
+  }
+
+  result.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+  result.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  result.bytes = (uint64_t)canvas.size() * result.iterations;
+  result.overruns = 0;
+
+  for (size_t x = 0; x < NTK_WIDTH; x++) {
+    for (size_t y = 0; y < NTK_HEIGHT; y++) {
+      const uint8_t *p = &canvas[y * stride + x * format];
+      int gray = (format == PACK_RGBA) ? (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8 : p[0];
+      bool lit = frame[x * rows + y / 8] & (0x80 >> (y % 8));
+      if (lit != (gray >= 128)) { return false; }
+    }
+  }
+  return true;
+}
+
+static bool bench_pack_gray(const BenchOptions &options, size_t size, BenchResult &result) {
+  return bench_pack(options, PACK_GRAY, result);
+}
+
+static bool bench_pack_rgba(const BenchOptions &options, size_t size, BenchResult &result) {
+  return bench_pack(options, PACK_RGBA, result);
+}
+
+// Dithering of a 256x128 RGBA gradient. Both must keep the average
+// brightness within 2%.
+static bool bench_dither(const BenchOptions &options, int method, BenchResult &result) {
+  const size_t stride = NTK_WIDTH * PACK_RGBA;
+  const size_t rows = NTK_HEIGHT / 8;
+  std::vector<uint8_t> canvas(stride * NTK_HEIGHT);
+  uint64_t gray_sum = 0;
+  for (size_t y = 0; y < NTK_HEIGHT; y++) {
+    for (size_t x = 0; x < NTK_WIDTH; x++) {
+      uint8_t *p = &canvas[y * stride + x * PACK_RGBA];
+      p[0] = p[1] = p[2] = x;
+      p[3] = 255;
+      gray_sum += (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    }
+  }
+  std::vector<uint8_t> frame(NTK_WIDTH * rows);
+
+  result.iterations = iterations_for(options, frame.size()) * 8;
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (size_t i = 0; i < result.iterations; i++) {
+    if (method == DITHER_BAYER) {
+      dither_bayer(&frame[0], rows, &canvas[0], stride, PACK_RGBA, NTK_WIDTH, NTK_HEIGHT, 0);
+    } else {
+      dither_floyd_steinberg(&frame[0], rows, &canvas[0], stride, PACK_RGBA, NTK_WIDTH, NTK_HEIGHT);
+    }
+  }
+
+  result.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+  result.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  result.bytes = (uint64_t)canvas.size() * result.iterations;
+  result.overruns = 0;
+
+  uint64_t lit = 0;
+  for (size_t i = 0; i < frame.size(); i++) {
+    lit += __builtin_popcount(frame[i]);
+  }
+  double expected = gray_sum / 255.0;
+  return lit > expected * 0.98 && lit < expected * 1.02;
+}
+
+static bool bench_dither_bayer(const BenchOptions &options, size_t size, BenchResult &result) {
+  return bench_dither(options, DITHER_BAYER, result);
+}
+
+static bool bench_dither_fs(const BenchOptions &options, size_t size, BenchResult &result) {
+  return bench_dither(options, DITHER_FLOYD_STEINBERG, result);
+}
+
+// interleave() of size bytes to each of --displays simulated displays.
+// bytes is the total over all displays.
+static bool bench_interleave(const BenchOptions &options, size_t size, BenchResult &result) {
+  std::vector<SpiDevice *> devices;
+  std::vector<InterleaveJob> jobs;
+  std::vector<char> data(size);
+  for (size_t i = 0; i < size; i++) { data[i] = rand(); }
+
+  bool ok = true;
+  for (uint32_t d = 0; d < options.displays; d++) {
+    SpiDevice *device = new SpiDevice();
+    setup_device(options, *device);
+    devices.push_back(device);
+    if (device->open("sim")) { ok = false; }
+
+    InterleaveJob job = { device, &data[0], size, 0, 0 };
+    jobs.push_back(job);
+  }
+
+  result.iterations = iterations_for(options, size * options.displays);
+  double start = clock_seconds(CLOCK_MONOTONIC);
+  double cpu_start = clock_seconds(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (size_t i = 0; i < result.iterations && ok; i++) {
+    interleave(jobs);
+    for (size_t j = 0; j < jobs.size(); j++) {
+      if (jobs[j].result != (int)size) { ok = false; }
+    }
+  }
+
+  result.seconds = clock_seconds(CLOCK_MONOTONIC) - start;
+  result.cpu_seconds = clock_seconds(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+  result.bytes = (uint64_t)size * options.displays * result.iterations;
+  result.overruns = 0;
+  for (size_t d = 0; d < devices.size(); d++) {
+    result.overruns += devices[d]->m_sim->overruns();
+    delete devices[d];
+  }
+  return ok;
+}
+
+// Benches that are not sized run once, with the size of a whole frame
+static const struct {
+  const char *name;
+  BenchFunction function;
+  bool sized;
+} benches[] = {
+  { "transfer", bench_transfer, true },
+  { "commit", bench_commit, true },
+  { "interleave", bench_interleave, true },
+  { "pack-gray", bench_pack_gray, false },
+  { "pack-rgba", bench_pack_rgba, false },
+  { "dither-bayer", bench_dither_bayer, false },
+  { "dither-fs", bench_dither_fs, false },
+};
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+  if (sorted.empty()) { return 0; }
+  size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+static void print_result(const char *name, BenchResult &result, bool first) {
+  std::sort(result.latencies.begin(), result.latencies.end());
+
+  // Only the transfer benches time single bytes: null rather than a 0 ns
+  // that --compare would take for a measurement
+  char latency[128] = "null";
+  if (!result.latencies.empty()) {
+    snprintf(latency, sizeof(latency), "{\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}",
+             (unsigned long long)percentile(result.latencies, 0.50),
+             (unsigned long long)percentile(result.latencies, 0.90),
+             (unsigned long long)percentile(result.latencies, 0.99),
+             (unsigned long long)result.latencies.back());
+  }
+
+  printf("%s\n    {\"bench\": \"%s\", \"size\": %zu, \"iterations\": %zu, "
+         "\"bytes\": %llu, \"seconds\": %.6f, \"cpuSeconds\": %.6f, "
+         "\"bytesPerSec\": %.1f, \"overruns\": %llu, \"byteLatencyNs\": %s}",
+         first ? "" : ",",
+         name, result.size, result.iterations,
+         (unsigned long long)result.bytes, result.seconds, result.cpu_seconds,
+         result.seconds > 0 ? result.bytes / result.seconds : 0,
+         (unsigned long long)result.overruns, latency);
+}
+
+static void parse_sizes(const char *list, std::vector<size_t> &sizes) {
+  sizes.clear();
+  while (*list) {
+    char *end;
+    size_t size = strtoul(list, &end, 10);
+    if (size) { sizes.push_back(size); }
+    list = (*end == ',') ? end + 1 : end;
+    if (end == list && *list) { list++; }
+  }
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  options.series_7000 = false;
+  options.burst = 1;
+  options.fifo = 0;
+  options.cs_strobe = false;
+  options.spi0 = false;
+  options.speed = 4000000;
+  options.settle_ns = 0;
+  options.bytes = 64 * 1024;
+  options.displays = 2;
+  // From a short command up to a full 256x128 Graphic DMA frame
+  parse_sizes("8,64,512,4104", options.sizes);
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = (i + 1 < argc) ? argv[i + 1] : "";
+
+    if (!strcmp(arg, "--series")) { options.series_7000 = !strcmp(value, "7000"); i++; }
+    else if (!strcmp(arg, "--burst")) { options.burst = atoi(value); i++; }
+    else if (!strcmp(arg, "--fifo")) { options.fifo = atoi(value); i++; }
+    else if (!strcmp(arg, "--speed")) { options.speed = atoi(value); i++; }
+    else if (!strcmp(arg, "--settle")) { options.settle_ns = atoi(value); i++; }
+    else if (!strcmp(arg, "--bytes")) { options.bytes = atoi(value); i++; }
+    else if (!strcmp(arg, "--displays")) { options.displays = atoi(value); i++; }
+    else if (!strcmp(arg, "--sizes")) { parse_sizes(value, options.sizes); i++; }
+    else if (!strcmp(arg, "--cs-strobe")) { options.cs_strobe = true; }
+    else if (!strcmp(arg, "--spi0")) { options.spi0 = true; }
+    else {
+      fprintf(stderr, "Unknown option: %s\n", arg);
+      return 1;
+    }
+  }
+
+  if (options.burst < 1 || options.burst > MAX_BURST || !options.speed || !options.bytes ||
+      !options.displays) {
+    fprintf(stderr, "Invalid options\n");
+    return 1;
+  }
+
+  printf("{\"series\": \"%s\", \"burst\": %u, \"fifo\": %u, \"csStrobe\": %s, \"spi0\": %s, "
+         "\"speed\": %u, \"settle\": %u, \"displays\": %u, \"pack\": \"%s\", \"results\": [",
+         options.series_7000 ? "7000" : "3900", options.burst, options.fifo,
+         options.cs_strobe ? "true" : "false", options.spi0 ? "true" : "false", options.speed, options.settle_ns,
+         options.displays, pack_kernel());
+
+  bool first = true;
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+    size_t count = benches[b].sized ? options.sizes.size() : 1;
+    for (size_t s = 0; s < count; s++) {
+      BenchResult result;
+      result.size = benches[b].sized ? options.sizes[s] : NTK_WIDTH * NTK_HEIGHT / 8;
+      if (!benches[b].function(options, result.size, result)) {
+        fprintf(stderr, "%s failed for size %zu\n", benches[b].name, result.size);
+        return 1;
+      }
+      print_result(benches[b].name, result, first);
+      first = false;
+    }
+  }
+
+  printf("\n]}\n");
+  return 0;
+}
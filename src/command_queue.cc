@@ -0,0 +1,127 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "command_queue.h"
+#include "ntk3900.h"
+
+#define NTK_ESC            0x1B
+#define NTK_BRIGHTNESS     0x58   // n
+#define NTK_FONT_SET       0x52   // ESC R n
+#define NTK_CODE_TYPE      0x74   // ESC t n
+#define NTK_EXT_FONT       0x67   // US ( g 01h n, font size
+#define NTK_EXT_FONT_SIZE  0x01
+
+CommandQueue::CommandQueue() {
+  forget();
+}
+
+void CommandQueue::forget() {
+  for (int i = 0; i < CMD_KINDS; i++) { m_known.value[i] = -1; }
+}
+
+CommandKind CommandQueue::classify(const uint8_t *data, size_t length, int64_t &value) {
+  if (length == 3 && data[0] == NTK_US && data[1] == NTK_BRIGHTNESS) {
+    value = data[2];
+    return CMD_BRIGHTNESS;
+  }
+  if (length == 6 && data[0] == NTK_US && data[1] == NTK_CURSOR_SET) {
+    value = data[2] | data[3] << 8 | data[4] << 16 | (int64_t)data[5] << 24;
+    return CMD_CURSOR;
+  }
+  if (length == 3 && data[0] == NTK_ESC && data[1] == NTK_FONT_SET) {
+    value = data[2];
+    return CMD_FONT_SET;
+  }
+  if (length == 3 && data[0] == NTK_ESC && data[1] == NTK_CODE_TYPE) {
+    value = data[2];
+    return CMD_CODE_TYPE;
+  }
+  if (length == 5 && data[0] == NTK_US && data[1] == NTK_EXT &&
+      data[2] == NTK_EXT_FONT && data[3] == NTK_EXT_FONT_SIZE) {
+    value = data[4];
+    return CMD_FONT_SIZE;
+  }
+  return CMD_OPAQUE;
+}
+
+uint32_t CommandQueue::push(const uint8_t *data, size_t length) {
+  if (!length) { return 0; }
+
+  Entry entry;
+  entry.kind = classify(data, length, entry.value);
+  entry.control = false;
+  entry.dropped = false;
+  entry.offset = m_bytes.size();
+  entry.length = length;
+  if (entry.kind == CMD_OPAQUE) {
+    for (size_t i = 0; i < length && !entry.control; i++) {
+      entry.control = data[i] == NTK_ESC || data[i] == NTK_US;
+    }
+  }
+
+  // Look back for a command of the same kind nothing has used yet. Text and
+  // images use the cursor and fonts, but not the brightness.
+  uint32_t redundant = 0;
+  if (entry.kind != CMD_OPAQUE) {
+    for (size_t i = m_entries.size(); i-- > 0; ) {
+      Entry &earlier = m_entries[i];
+      if (earlier.kind == CMD_OPAQUE &&
+          (earlier.control || entry.kind != CMD_BRIGHTNESS)) {
+        break;
+      }
+      if (earlier.kind == entry.kind && !earlier.dropped) {
+        earlier.dropped = true;
+        redundant++;
+        break;
+      }
+    }
+  }
+
+  m_entries.push_back(entry);
+  m_bytes.insert(m_bytes.end(), data, data + length);
+  return redundant;
+}
+
+uint32_t CommandQueue::take(std::vector<uint8_t> &out, CommandState &state) {
+  out.clear();
+  state = m_known;
+
+  uint32_t redundant = 0;
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    const Entry &entry = m_entries[i];
+    if (entry.dropped) { continue; }
+
+    if (entry.kind != CMD_OPAQUE) {
+      if (state.value[entry.kind] == entry.value) {
+        redundant++;
+        continue;
+      }
+      state.value[entry.kind] = entry.value;
+    } else if (entry.control) {
+      for (int k = 0; k < CMD_KINDS; k++) { state.value[k] = -1; }
+    } else {
+      // Text moves the cursor
+      state.value[CMD_CURSOR] = -1;
+    }
+
+    out.insert(out.end(), m_bytes.begin() + entry.offset,
+               m_bytes.begin() + entry.offset + entry.length);
+  }
+
+  m_entries.clear();
+  m_bytes.clear();
+  return redundant;
+}
@@ -0,0 +1,84 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Display state commands the queue knows about. The byte sequences are the
+// 7000 series and B-series ones.
+enum CommandKind {
+  CMD_BRIGHTNESS,   // 1Fh 58h n
+  CMD_CURSOR,       // 1Fh 24h xL xH yL yH
+  CMD_FONT_SET,     // 1Bh 52h n, international font set
+  CMD_CODE_TYPE,    // 1Bh 74h n, character code type
+  CMD_FONT_SIZE,    // 1Fh 28h 67h 01h n
+  CMD_KINDS,
+  CMD_OPAQUE = CMD_KINDS   // text, images, anything else
+};
+
+// What the display was last set to, -1 where unknown
+struct CommandState {
+  int64_t value[CMD_KINDS];
+};
+
+// Collects small writes so that they go out as one transfer, leaving out
+// state commands that change nothing: one superseded by a later command of
+// the same kind before anything used it, or one setting what the display
+// already has.
+//
+// Each push() is one command or a run of opaque bytes. A state command is
+// only recognised when it is a whole push on its own. Opaque bytes with ESC
+// or US in them may hold commands the queue does not parse, so they make
+// the whole state unknown.
+class CommandQueue {
+    public:
+        CommandQueue();
+
+        bool empty() const { return m_entries.empty(); }
+        size_t size() const { return m_bytes.size(); }
+
+        // Returns the number of queued commands this one made redundant
+        uint32_t push(const uint8_t *data, size_t length);
+
+        // Moves what is left to send into out and clears the queue. state is
+        // what the display is set to once out was sent. Returns the number
+        // of commands left out because the display already had their value.
+        uint32_t take(std::vector<uint8_t> &out, CommandState &state);
+
+        // out from take() went through, or something else was sent and the
+        // display state is unknown
+        void sent(const CommandState &state) { m_known = state; }
+        void forget();
+
+    private:
+        struct Entry {
+          CommandKind kind;
+          bool control;      // opaque bytes with ESC or US in them
+          bool dropped;
+          int64_t value;
+          size_t offset;
+          size_t length;
+        };
+
+        static CommandKind classify(const uint8_t *data, size_t length, int64_t &value);
+
+        std::vector<Entry> m_entries;
+        std::vector<uint8_t> m_bytes;
+        CommandState m_known;
+};
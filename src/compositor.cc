@@ -0,0 +1,251 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "compositor.h"
+
+#include <string.h>
+#include <algorithm>
+
+Compositor::Compositor(uint32_t width, uint32_t height) :
+        m_width(width),
+        m_rows(height / 8),
+        m_next_id(1),
+        m_frame(width * (height / 8), 0),
+        m_dirty(width, 0),
+        m_column(height / 8, 0) {
+}
+
+int Compositor::add(uint32_t width, uint32_t height, int z, int blend) {
+  if (!width || !height || blend < BLEND_OR || blend > BLEND_XOR) { return -1; }
+
+  Layer layer;
+  layer.id = m_next_id++;
+  layer.z = z;
+  layer.x = 0;
+  layer.y = 0;
+  layer.width = width;
+  layer.height = height;
+  layer.bitmap_width = width;
+  layer.rows = (height + 7) / 8;
+  layer.scroll = 0;
+  layer.blend = blend;
+  layer.visible = true;
+  layer.clipped = false;
+  layer.clip.x = layer.clip.y = layer.clip.width = layer.clip.height = 0;
+  layer.bitmap.assign(width * layer.rows, 0);
+
+  m_layers.push_back(layer);
+  sort();
+  // A dark OR or XOR layer changes nothing, an AND one clears its area
+  if (blend == BLEND_AND) { touch(*find(layer.id)); }
+  return layer.id;
+}
+
+bool Compositor::remove(int id) {
+  for (size_t i = 0; i < m_layers.size(); i++) {
+    if (m_layers[i].id == id) {
+      touch(m_layers[i]);
+      m_layers.erase(m_layers.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Compositor::set_bitmap(int id, const uint8_t *data, size_t length) {
+  Layer *layer = find(id);
+  if (!layer || length != layer->bitmap.size()) { return false; }
+
+  memcpy(&layer->bitmap[0], data, length);
+  touch(*layer);
+  return true;
+}
+
+bool Compositor::move(int id, int x, int y) {
+  Layer *layer = find(id);
+  if (!layer) { return false; }
+
+  touch(*layer);
+  layer->x = x;
+  layer->y = y;
+  touch(*layer);
+  return true;
+}
+
+bool Compositor::set_z(int id, int z) {
+  Layer *layer = find(id);
+  if (!layer) { return false; }
+
+  touch(*layer);
+  layer->z = z;
+  sort();
+  return true;
+}
+
+bool Compositor::set_blend(int id, int blend) {
+  Layer *layer = find(id);
+  if (!layer || blend < BLEND_OR || blend > BLEND_XOR) { return false; }
+
+  touch(*layer);
+  layer->blend = blend;
+  return true;
+}
+
+bool Compositor::set_visible(int id, bool visible) {
+  Layer *layer = find(id);
+  if (!layer) { return false; }
+
+  layer->visible = true;
+  touch(*layer);
+  layer->visible = visible;
+  return true;
+}
+
+bool Compositor::set_clip(int id, const ClipRect &clip) {
+  Layer *layer = find(id);
+  if (!layer || clip.width < 0 || clip.height < 0) { return false; }
+
+  touch(*layer);
+  layer->clipped = true;
+  layer->clip = clip;
+  touch(*layer);
+  return true;
+}
+
+bool Compositor::set_scroll(int id, uint32_t offset) {
+  Layer *layer = find(id);
+  if (!layer) { return false; }
+
+  layer->scroll = offset % layer->bitmap_width;
+  touch(*layer);
+  return true;
+}
+
+bool Compositor::set_width(int id, uint32_t width) {
+  Layer *layer = find(id);
+  if (!layer || !width) { return false; }
+
+  touch(*layer);
+  layer->width = width;
+  touch(*layer);
+  return true;
+}
+
+void Compositor::invalidate() {
+  memset(&m_dirty[0], 1, m_width);
+}
+
+uint32_t Compositor::compose(std::vector<uint8_t> &changed) {
+  changed.resize(m_width, 0);
+
+  // Visible extents, computed once for all columns
+  struct Extent { int x0, x1, y0, y1; };
+  std::vector<Extent> extents(m_layers.size());
+  for (size_t i = 0; i < m_layers.size(); i++) {
+    Extent &e = extents[i];
+    if (!m_layers[i].visible || !extent(m_layers[i], e.x0, e.x1, e.y0, e.y1)) {
+      e.x0 = e.x1 = 0;
+    }
+  }
+
+  uint32_t count = 0;
+  for (uint32_t x = 0; x < m_width; x++) {
+    if (!m_dirty[x]) { continue; }
+    m_dirty[x] = 0;
+
+    uint8_t *column = &m_column[0];
+    memset(column, 0, m_rows);
+    for (size_t i = 0; i < m_layers.size(); i++) {
+      if ((int)x >= extents[i].x0 && (int)x < extents[i].x1) {
+        blend_column(m_layers[i], x, extents[i].y0, extents[i].y1, column);
+      }
+    }
+
+    uint8_t *dest = &m_frame[x * m_rows];
+    if (memcmp(dest, column, m_rows) != 0) {
+      memcpy(dest, column, m_rows);
+      changed[x] = 1;
+      count++;
+    }
+  }
+  return count;
+}
+
+Compositor::Layer *Compositor::find(int id) {
+  for (size_t i = 0; i < m_layers.size(); i++) {
+    if (m_layers[i].id == id) { return &m_layers[i]; }
+  }
+  return NULL;
+}
+
+bool Compositor::below(const Layer &a, const Layer &b) {
+  return a.z < b.z || (a.z == b.z && a.id < b.id);
+}
+
+void Compositor::sort() {
+  std::sort(m_layers.begin(), m_layers.end(), below);
+}
+
+void Compositor::touch(const Layer &layer) {
+  int x0, x1, y0, y1;
+  if (!layer.visible || !extent(layer, x0, x1, y0, y1)) { return; }
+  memset(&m_dirty[x0], 1, x1 - x0);
+}
+
+bool Compositor::extent(const Layer &layer, int &x0, int &x1, int &y0, int &y1) const {
+  x0 = std::max(layer.x, 0);
+  y0 = std::max(layer.y, 0);
+  x1 = std::min<int64_t>((int64_t)layer.x + layer.width, m_width);
+  y1 = std::min<int64_t>((int64_t)layer.y + layer.height, m_rows * 8);
+  if (layer.clipped) {
+    x0 = std::max(x0, layer.clip.x);
+    y0 = std::max(y0, layer.clip.y);
+    x1 = std::min<int64_t>(x1, (int64_t)layer.clip.x + layer.clip.width);
+    y1 = std::min<int64_t>(y1, (int64_t)layer.clip.y + layer.clip.height);
+  }
+  return x0 < x1 && y0 < y1;
+}
+
+// Blends one layer column over display pixel rows y0 to y1. Layer pixels are
+// shifted down by the layer y within each display byte.
+void Compositor::blend_column(const Layer &layer, uint32_t x, int y0, int y1, uint8_t *column) const {
+  uint32_t bitmap_x = ((x - layer.x) + layer.scroll) % layer.bitmap_width;
+  const uint8_t *src = &layer.bitmap[bitmap_x * layer.rows];
+
+  for (int row = y0 >> 3; row <= (y1 - 1) >> 3; row++) {
+    // Layer pixel row shown at the top of this display byte
+    int top = row * 8 - layer.y;
+    uint8_t bits;
+    if (top >= 0) {
+      uint32_t byte = top >> 3, shift = top & 7;
+      bits = src[byte] << shift;
+      if (shift && byte + 1 < layer.rows) { bits |= src[byte + 1] >> (8 - shift); }
+    } else {
+      bits = src[0] >> -top;
+    }
+
+    // Display rows of this byte inside y0 to y1
+    int first = std::max(y0 - row * 8, 0);
+    int last = std::min(y1 - row * 8, 8);
+    uint8_t mask = (0xff >> first) & (uint8_t)(0xff << (8 - last));
+
+    switch (layer.blend) {
+      case BLEND_AND: column[row] &= bits | ~mask; break;
+      case BLEND_XOR: column[row] ^= bits & mask; break;
+      default:        column[row] |= bits & mask; break;
+    }
+  }
+}
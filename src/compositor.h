@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// How a layer is combined with the layers below it
+#define BLEND_OR   0
+#define BLEND_AND  1   // clears the pixels the layer leaves dark
+#define BLEND_XOR  2
+
+// Pixel rectangle on the display
+struct ClipRect {
+  int x;
+  int y;
+  int width;
+  int height;
+};
+
+// Bitmap layers stacked into a display frame. Layers are column major 1bpp
+// bitmaps like the display memory, placed at any pixel position, clipped to
+// a rectangle and blended bottom (lowest z) to top onto a dark frame.
+//
+// Every change marks the columns it covers before and after it as dirty, and
+// compose() only rebuilds those, so a moving sprite costs its own width, not
+// the whole display. Not thread safe.
+class Compositor {
+    public:
+        Compositor(uint32_t width, uint32_t height);
+
+        // The composed frame, width * height / 8 bytes
+        const uint8_t *frame() const { return &m_frame[0]; }
+        size_t size() const { return m_frame.size(); }
+
+        // Adds a dark width x height layer and returns its id. Equal z keeps
+        // the order layers were added in, the newest on top.
+        int add(uint32_t width, uint32_t height, int z, int blend);
+        bool remove(int id);
+        bool has(int id) { return find(id) != NULL; }
+
+        // The setters return false for an unknown id or bad arguments.
+        // data is width * ((height + 7) / 8) bytes, column major.
+        bool set_bitmap(int id, const uint8_t *data, size_t length);
+        bool move(int id, int x, int y);
+        bool set_z(int id, int z);
+        bool set_blend(int id, int blend);
+        bool set_visible(int id, bool visible);
+        bool set_clip(int id, const ClipRect &clip);
+        // Shows the bitmap from column offset on, wrapping around: a layer
+        // wider than its bitmap repeats it like a tile, and a growing offset
+        // scrolls it like a ticker.
+        bool set_scroll(int id, uint32_t offset);
+        bool set_width(int id, uint32_t width);
+
+        // Rebuilds the dirty columns. changed holds one flag per column; the
+        // flags of the columns that now differ from the last compose() are
+        // set, the others are left alone so that changes can add up over
+        // several composes. Returns the number of columns that changed.
+        uint32_t compose(std::vector<uint8_t> &changed);
+
+        // Marks everything dirty
+        void invalidate();
+
+    private:
+        struct Layer {
+          int id;
+          int z;
+          int x;
+          int y;
+          uint32_t width;       // on the display
+          uint32_t height;
+          uint32_t bitmap_width;
+          uint32_t rows;        // bytes per bitmap column
+          uint32_t scroll;
+          int blend;
+          bool visible;
+          bool clipped;
+          ClipRect clip;
+          std::vector<uint8_t> bitmap;
+        };
+
+        Layer *find(int id);
+        static bool below(const Layer &a, const Layer &b);
+        void sort();
+        // Marks the columns the layer shows on
+        void touch(const Layer &layer);
+        // Visible column and pixel row ranges of a layer, false if none
+        bool extent(const Layer &layer, int &x0, int &x1, int &y0, int &y1) const;
+        void blend_column(const Layer &layer, uint32_t x, int y0, int y1, uint8_t *column) const;
+
+        uint32_t m_width;
+        uint32_t m_rows;
+        int m_next_id;
+        std::vector<Layer> m_layers;   // by z, bottom first
+        std::vector<uint8_t> m_frame;
+        std::vector<uint8_t> m_dirty;  // per column
+        std::vector<uint8_t> m_column;
+};
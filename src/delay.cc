@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "delay.h"
+
+#include <pthread.h>
+#include <time.h>
+
+static DelayTiming timing;
+static pthread_once_t calibrated = PTHREAD_ONCE_INIT;
+
+uint64_t delay_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void spin_loops(uint64_t loops) {
+  for (volatile uint64_t i = 0; i < loops; i++) {}
+}
+
+static void calibrate() {
+  struct timespec res;
+  clock_getres(CLOCK_MONOTONIC, &res);
+  timing.resolution_ns = (uint64_t)res.tv_sec * 1000000000ULL + res.tv_nsec;
+
+  // Best of a few runs, so a preemption does not skew the numbers
+  uint64_t overhead = ~0ULL;
+  for (int run = 0; run < 5; run++) {
+    uint64_t start = delay_now_ns();
+    for (int i = 0; i < 1000; i++) { delay_now_ns(); }
+    uint64_t elapsed = (delay_now_ns() - start) / 1001;
+    if (elapsed < overhead) { overhead = elapsed; }
+  }
+  timing.clock_overhead_ns = overhead;
+
+  const uint64_t loops = 100000;
+  uint64_t best = ~0ULL;
+  for (int run = 0; run < 5; run++) {
+    uint64_t start = delay_now_ns();
+    spin_loops(loops);
+    uint64_t elapsed = delay_now_ns() - start;
+    if (elapsed < best) { best = elapsed; }
+  }
+  timing.loops_per_us = best ? loops * 1000 / best : 1;
+}
+
+void delay_ns(uint64_t ns) {
+  pthread_once(&calibrated, calibrate);
+  if (!ns) { return; }
+
+  if (ns < 2 * timing.clock_overhead_ns) {
+    spin_loops(ns * timing.loops_per_us / 1000);
+    return;
+  }
+
+  uint64_t end = delay_now_ns() + ns - timing.clock_overhead_ns;
+  while (delay_now_ns() < end) {}
+}
+
+const DelayTiming &delay_timing() {
+  pthread_once(&calibrated, calibrate);
+  return timing;
+}
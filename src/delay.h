@@ -0,0 +1,36 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Busy-wait delays on the monotonic clock, with nanosecond resolution.
+//
+// Reading the clock is not free (a few tens of ns through the vDSO, a lot
+// more on some kernels), so the clock and a plain counting loop are
+// calibrated the first time a delay is used. Delays shorter than a couple
+// of clock reads are done with the counting loop.
+
+struct DelayTiming {
+  uint64_t resolution_ns;       // clock_getres() of CLOCK_MONOTONIC
+  uint64_t clock_overhead_ns;   // cost of one clock read
+  uint64_t loops_per_us;        // iterations of the counting loop per us
+};
+
+uint64_t delay_now_ns();
+void delay_ns(uint64_t ns);
+const DelayTiming &delay_timing();
@@ -0,0 +1,87 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "dither.h"
+#include "pack.h"
+
+#include <string.h>
+#include <vector>
+
+static const uint8_t bayer8[8][8] = {
+  {  0, 32,  8, 40,  2, 34, 10, 42 },
+  { 48, 16, 56, 24, 50, 18, 58, 26 },
+  { 12, 44,  4, 36, 14, 46,  6, 38 },
+  { 60, 28, 52, 20, 62, 30, 54, 22 },
+  {  3, 35, 11, 43,  1, 33,  9, 41 },
+  { 51, 19, 59, 27, 49, 17, 57, 25 },
+  { 15, 47,  7, 39, 13, 45,  5, 37 },
+  { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+void dither_bayer(uint8_t *out, uint32_t out_rows,
+                  const uint8_t *src, size_t stride, int format,
+                  uint32_t width, uint32_t height, uint32_t x) {
+  // Thresholds from 2 to 254: black stays black, white stays white. Bands
+  // start on multiples of 8 rows, so only the columns need lining up.
+  uint8_t threshold[8][16];
+  for (int r = 0; r < 8; r++) {
+    for (int c = 0; c < 16; c++) {
+      threshold[r][c] = bayer8[r][(c + x) & 7] * 4 + 2;
+    }
+  }
+  pack_1bpp(out, out_rows, src, stride, format, width, height, threshold);
+}
+
+void dither_floyd_steinberg(uint8_t *out, uint32_t out_rows,
+                            const uint8_t *src, size_t stride, int format,
+                            uint32_t width, uint32_t height) {
+  std::vector<uint8_t> gray(width);
+  // Error for this row and the next one, with a guard pixel at each end
+  std::vector<int16_t> error_a(width + 2, 0);
+  std::vector<int16_t> error_b(width + 2, 0);
+  int16_t *current = &error_a[1];
+  int16_t *next = &error_b[1];
+
+  for (uint32_t y = 0; y < height; y++) {
+    pack_gray_row(&gray[0], src + y * stride, format, width);
+
+    uint8_t bit = 0x80 >> (y & 7);
+    uint8_t *band = out + y / 8;
+    bool reverse = y & 1;
+    int step = reverse ? -1 : 1;
+
+    for (uint32_t i = 0; i < width; i++) {
+      int x = reverse ? width - 1 - i : i;
+      int value = gray[x] + current[x];
+      bool lit = value >= 128;
+      int error = value - (lit ? 255 : 0);
+
+      uint8_t &byte = band[x * out_rows];
+      if (bit == 0x80) { byte = 0; }
+      if (lit) { byte |= bit; }
+
+      current[x + step] += error * 7 / 16;
+      next[x - step] += error * 3 / 16;
+      next[x] += error * 5 / 16;
+      next[x + step] += error / 16;
+    }
+
+    int16_t *swap = current;
+    current = next;
+    next = swap;
+    memset(next - 1, 0, (width + 2) * sizeof(int16_t));
+  }
+}
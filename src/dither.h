@@ -0,0 +1,39 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Dithering of gray or RGBA canvases straight to the packed display layout.
+// Same arguments as pack_1bpp() in pack.h.
+
+#define DITHER_BAYER            0
+#define DITHER_FLOYD_STEINBERG  1
+
+// Ordered dithering with an 8x8 Bayer matrix, on the SIMD pack kernel. x is
+// the display column of the first pixel, so that a region dithered on its
+// own lines up with its neighbours.
+void dither_bayer(uint8_t *out, uint32_t out_rows,
+                  const uint8_t *src, size_t stride, int format,
+                  uint32_t width, uint32_t height, uint32_t x);
+
+// Floyd-Steinberg error diffusion, serpentine scan. The error does not cross
+// the edges of the region.
+void dither_floyd_steinberg(uint8_t *out, uint32_t out_rows,
+                            const uint8_t *src, size_t stride, int format,
+                            uint32_t width, uint32_t height);
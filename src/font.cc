@@ -0,0 +1,313 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "font.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Classic 5x7 ASCII font, 0x20 to 0x7E: five columns per glyph, bit 0 the
+// top row
+static const uint8_t builtin_5x7[95][5] = {
+  {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00},
+  {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7F, 0x14, 0x7F, 0x14},
+  {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+  {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+  {0x00, 0x1C, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1C, 0x00},
+  {0x08, 0x2A, 0x1C, 0x2A, 0x08}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+  {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08},
+  {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+  {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+  {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31},
+  {0x18, 0x14, 0x12, 0x7F, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39},
+  {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+  {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E},
+  {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+  {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+  {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+  {0x32, 0x49, 0x79, 0x41, 0x3E}, {0x7E, 0x11, 0x11, 0x11, 0x7E},
+  {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+  {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41},
+  {0x7F, 0x09, 0x09, 0x01, 0x01}, {0x3E, 0x41, 0x41, 0x51, 0x32},
+  {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+  {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41},
+  {0x7F, 0x40, 0x40, 0x40, 0x40}, {0x7F, 0x02, 0x04, 0x02, 0x7F},
+  {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+  {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E},
+  {0x7F, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+  {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+  {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x7F, 0x20, 0x18, 0x20, 0x7F},
+  {0x63, 0x14, 0x08, 0x14, 0x63}, {0x03, 0x04, 0x78, 0x04, 0x03},
+  {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x00, 0x7F, 0x41, 0x41},
+  {0x02, 0x04, 0x08, 0x10, 0x20}, {0x41, 0x41, 0x7F, 0x00, 0x00},
+  {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+  {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+  {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+  {0x38, 0x44, 0x44, 0x48, 0x7F}, {0x38, 0x54, 0x54, 0x54, 0x18},
+  {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x08, 0x14, 0x54, 0x54, 0x3C},
+  {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00},
+  {0x20, 0x40, 0x44, 0x3D, 0x00}, {0x00, 0x7F, 0x10, 0x28, 0x44},
+  {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+  {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+  {0x7C, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7C},
+  {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+  {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C},
+  {0x1C, 0x20, 0x40, 0x20, 0x1C}, {0x3C, 0x40, 0x30, 0x40, 0x3C},
+  {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+  {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+  {0x00, 0x00, 0x7F, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00},
+  {0x02, 0x01, 0x02, 0x04, 0x02}
+};
+
+// Cell mask of the top rows rows
+static uint32_t cell_mask(uint32_t rows) {
+  return rows >= 32 ? 0xffffffff : ~(0xffffffff >> rows);
+}
+
+// Next code point of a UTF-8 string, U+FFFD for malformed input
+static uint32_t next_codepoint(const std::string &text, size_t &i) {
+  uint8_t c = text[i++];
+  if (c < 0x80) { return c; }
+
+  int extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : -1;
+  if (extra < 0) { return 0xFFFD; }
+
+  uint32_t codepoint = c & (0x3F >> extra);
+  for (int k = 0; k < extra; k++) {
+    if (i >= text.size() || (text[i] & 0xC0) != 0x80) { return 0xFFFD; }
+    codepoint = codepoint << 6 | (text[i++] & 0x3F);
+  }
+  return codepoint;
+}
+
+Font *Font::builtin() {
+  Font *font = new Font();
+  font->m_height = 8;
+  font->m_ascent = 7;
+  font->m_default = '?';
+
+  for (int c = 0; c < 95; c++) {
+    uint32_t columns[5];
+    for (int x = 0; x < 5; x++) {
+      uint32_t mask = 0;
+      for (int row = 0; row < 8; row++) {
+        if (builtin_5x7[c][x] & (1 << row)) { mask |= 0x80000000 >> row; }
+      }
+      columns[x] = mask;
+    }
+    font->add_glyph(0x20 + c, columns, 5, 0, 6);
+  }
+  return font;
+}
+
+// One line of BDF text starting at pos, advancing pos past it
+static std::string next_line(const char *text, size_t length, size_t &pos) {
+  size_t start = pos;
+  while (pos < length && text[pos] != '\n') { pos++; }
+  size_t end = pos;
+  if (pos < length) { pos++; }
+  if (end > start && text[end - 1] == '\r') { end--; }
+  return std::string(text + start, end - start);
+}
+
+static bool keyword(const std::string &line, const char *word) {
+  size_t n = strlen(word);
+  return line.compare(0, n, word) == 0 && (line.size() == n || line[n] == ' ');
+}
+
+Font *Font::load_bdf(const char *text, size_t length, const char **error) {
+  Font *font = new Font();
+  int ascent = -1, descent = -1;
+  int box_h = 0, box_yoff = 0;
+  int default_char = -1;
+
+  // Current glyph
+  int encoding = -1, dwidth = 0;
+  int w = 0, h = 0, xoff = 0, yoff = 0;
+  std::vector<uint32_t> columns;
+  bool in_char = false, in_bitmap = false;
+  int row = 0;
+
+  *error = NULL;
+  size_t pos = 0;
+  if (length < 9 || strncmp(text, "STARTFONT", 9) != 0) {
+    *error = "Not a BDF font";
+  }
+
+  while (!*error && pos < length) {
+    std::string line = next_line(text, length, pos);
+    size_t space = line.find(' ');
+    const char *args = line.c_str() + (space == std::string::npos ? line.size() : space + 1);
+
+    if (in_bitmap && !keyword(line, "ENDCHAR")) {
+      // A hex row, most significant bit the leftmost pixel, padded to whole
+      // bytes of the BBX width. Shorter rows are padded on the right.
+      int bit_count = ((w + 7) / 8) * 8;
+      int digits = strspn(line.c_str(), "0123456789abcdefABCDEF");
+      if (bit_count > 32 || digits * 4 > bit_count) {
+        *error = "Malformed BITMAP";
+        break;
+      }
+      uint32_t bits = digits ? (uint32_t)strtoul(line.substr(0, digits).c_str(), NULL, 16) : 0;
+      if (digits && digits * 4 < bit_count) { bits <<= bit_count - digits * 4; }
+      int top = ascent - (h + yoff) + row++;
+      if (top < 0 || top >= (int)font->m_height) { continue; }
+      for (int x = 0; x < w; x++) {
+        if (bits & (1u << (bit_count - 1 - x))) { columns[x] |= 0x80000000 >> top; }
+      }
+    } else if (keyword(line, "FONT_ASCENT")) {
+      ascent = atoi(args);
+    } else if (keyword(line, "FONT_DESCENT")) {
+      descent = atoi(args);
+    } else if (keyword(line, "DEFAULT_CHAR")) {
+      default_char = atoi(args);
+    } else if (keyword(line, "FONTBOUNDINGBOX")) {
+      int bw;
+      if (sscanf(args, "%d %d %*d %d", &bw, &box_h, &box_yoff) != 3) {
+        *error = "Malformed FONTBOUNDINGBOX";
+      }
+    } else if (keyword(line, "STARTCHAR")) {
+      if (ascent < 0 || descent < 0) {
+        // No font properties, the bounding box gives the cell
+        ascent = box_h + box_yoff;
+        descent = -box_yoff;
+      }
+      if (ascent + descent <= 0 || ascent + descent > FONT_MAX_HEIGHT) {
+        *error = "Font height must be 1 to 32 pixels";
+        break;
+      }
+      font->m_height = ascent + descent;
+      font->m_ascent = ascent;
+      in_char = true;
+      encoding = -1;
+      dwidth = 0;
+      w = h = xoff = yoff = 0;
+    } else if (in_char && keyword(line, "ENCODING")) {
+      encoding = atoi(args);
+    } else if (in_char && keyword(line, "DWIDTH")) {
+      dwidth = atoi(args);
+    } else if (in_char && keyword(line, "BBX")) {
+      if (sscanf(args, "%d %d %d %d", &w, &h, &xoff, &yoff) != 4 || w < 0 || w > 32) {
+        *error = "Malformed BBX";
+      }
+    } else if (in_char && keyword(line, "BITMAP")) {
+      columns.assign(w, 0);
+      in_bitmap = true;
+      row = 0;
+    } else if (keyword(line, "ENDCHAR")) {
+      // Glyphs outside Unicode have encoding -1 and are skipped
+      if (encoding >= 0) {
+        font->add_glyph(encoding, columns.empty() ? NULL : &columns[0], w, xoff, dwidth);
+      }
+      in_char = in_bitmap = false;
+    }
+  }
+
+  if (!*error && font->m_glyphs.empty()) { *error = "Font has no glyphs"; }
+  if (*error) {
+    delete font;
+    return NULL;
+  }
+
+  font->m_default = default_char >= 0 ? default_char : '?';
+  return font;
+}
+
+void Font::add_glyph(uint32_t codepoint, const uint32_t *columns, uint16_t width,
+                     int16_t x_offset, int16_t advance) {
+  Glyph glyph;
+  glyph.offset = m_atlas.size();
+  glyph.width = width;
+  glyph.x_offset = x_offset;
+  glyph.advance = advance;
+  m_atlas.insert(m_atlas.end(), columns, columns + width);
+  m_glyphs[codepoint] = glyph;
+}
+
+const Glyph *Font::glyph(uint32_t codepoint) const {
+  std::map<uint32_t, Glyph>::const_iterator found = m_glyphs.find(codepoint);
+  if (found == m_glyphs.end()) { found = m_glyphs.find(m_default); }
+  return found == m_glyphs.end() ? NULL : &found->second;
+}
+
+// The string rendered into cell columns, from the cache when it was drawn
+// before
+const std::vector<uint32_t> &Font::run(const std::string &text) {
+  std::map<std::string, std::vector<uint32_t> >::iterator cached = m_runs.find(text);
+  if (cached != m_runs.end()) { return cached->second; }
+
+  if (m_runs.size() >= FONT_RUN_CACHE) { m_runs.clear(); }
+  std::vector<uint32_t> &columns = m_runs[text];
+
+  int pen = 0;
+  for (size_t i = 0; i < text.size(); ) {
+    const Glyph *g = glyph(next_codepoint(text, i));
+    if (!g) { continue; }
+
+    for (int x = 0; x < g->width; x++) {
+      int column = pen + g->x_offset + x;
+      if (column < 0) { continue; }
+      if ((size_t)column >= columns.size()) { columns.resize(column + 1, 0); }
+      columns[column] |= m_atlas[g->offset + x];
+    }
+    pen += g->advance;
+    if (pen > 0 && (size_t)pen > columns.size()) { columns.resize(pen, 0); }
+  }
+  return columns;
+}
+
+uint32_t Font::text_width(const std::string &text) {
+  return run(text).size();
+}
+
+uint32_t Font::draw(uint8_t *frame, uint32_t frame_width, uint32_t frame_rows,
+                    int x, int y, const std::string &text, int mode) {
+  const std::vector<uint32_t> &columns = run(text);
+  uint32_t cell = cell_mask(m_height);
+
+  // Rows above the frame are shifted out of the masks
+  uint32_t skip = 0;
+  if (y < 0) {
+    if (-y >= (int)m_height) { return columns.size(); }
+    skip = -y;
+    y = 0;
+  }
+  uint32_t row0 = y >> 3;
+  uint32_t shift = 32 - (y & 7);
+
+  for (size_t c = 0; c < columns.size(); c++) {
+    int64_t column = (int64_t)x + c;
+    if (column < 0) { continue; }
+    if (column >= frame_width) { break; }
+
+    uint64_t glyph = (uint64_t)(columns[c] << skip) << shift;
+    uint64_t area = (uint64_t)(cell << skip) << shift;
+    uint8_t *dest = frame + column * frame_rows;
+
+    for (uint32_t k = 0; k < 5 && row0 + k < frame_rows; k++) {
+      uint8_t g = glyph >> (56 - 8 * k);
+      uint8_t a = area >> (56 - 8 * k);
+      uint8_t &byte = dest[row0 + k];
+      switch (mode) {
+        case TEXT_REPLACE: byte = (byte & ~a) | g; break;
+        case TEXT_INVERT:  byte = (byte | a) & ~g; break;
+        default:           byte |= g; break;
+      }
+    }
+  }
+  return columns.size();
+}
@@ -0,0 +1,85 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <map>
+
+// How text pixels are combined with the frame
+#define TEXT_OR       0   // set the glyph pixels
+#define TEXT_REPLACE  1   // clear the text cells, then set the glyph pixels
+#define TEXT_INVERT   2   // set the text cells, clear the glyph pixels
+
+#define FONT_MAX_HEIGHT 32
+
+// Strings kept rendered per font before the cache starts over
+#define FONT_RUN_CACHE 256
+
+struct Glyph {
+  uint32_t offset;    // first column in the atlas
+  uint16_t width;     // columns in the atlas
+  int16_t x_offset;   // from the pen position to the first column
+  int16_t advance;
+};
+
+// A bitmap font rasterized once into a 1bpp atlas. Each atlas entry is one
+// glyph column as a mask over the text cell, bit 31 being the top row, so
+// that drawing is a shift and an OR per display byte. Whole strings are
+// cached the same way, repeated strings are a single blit.
+//
+// Frames use the display memory layout from ntk3900.h. Not thread safe: the
+// string cache is updated while drawing.
+class Font {
+    public:
+        // The built-in 5x7 ASCII font, in an 8 pixel cell
+        static Font *builtin();
+
+        // Parses a BDF font. Returns NULL with *error set when it cannot.
+        static Font *load_bdf(const char *text, size_t length, const char **error);
+
+        uint32_t height() const { return m_height; }
+        uint32_t ascent() const { return m_ascent; }
+        size_t glyphs() const { return m_glyphs.size(); }
+
+        // Width in pixels of a UTF-8 string
+        uint32_t text_width(const std::string &text);
+
+        // Draws a UTF-8 string with the top left of its first cell at (x, y),
+        // clipped to the frame. y need not be a multiple of 8. Returns the
+        // width drawn.
+        uint32_t draw(uint8_t *frame, uint32_t frame_width, uint32_t frame_rows,
+                      int x, int y, const std::string &text, int mode);
+
+    private:
+        Font() : m_height(0), m_ascent(0), m_default(0) {}
+
+        const Glyph *glyph(uint32_t codepoint) const;
+        const std::vector<uint32_t> &run(const std::string &text);
+        void add_glyph(uint32_t codepoint, const uint32_t *columns, uint16_t width,
+                       int16_t x_offset, int16_t advance);
+
+        uint32_t m_height;
+        uint32_t m_ascent;
+        uint32_t m_default;   // drawn for missing glyphs
+
+        std::vector<uint32_t> m_atlas;
+        std::map<uint32_t, Glyph> m_glyphs;
+        std::map<std::string, std::vector<uint32_t> > m_runs;
+};
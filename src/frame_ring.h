@@ -0,0 +1,69 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+// Single producer / single consumer lock-free ring. The JS thread pushes,
+// the transmit thread pops. Capacity is rounded up to a power of two.
+template <typename T>
+class FrameRing {
+    public:
+        explicit FrameRing(size_t capacity) : m_head(0), m_tail(0) {
+          size_t size = 1;
+          while (size < capacity) { size <<= 1; }
+          m_slots.resize(size);
+          m_mask = size - 1;
+        }
+
+        // Producer side. Returns false if the ring is full.
+        bool push(const T &item) {
+          size_t tail = m_tail.load(std::memory_order_relaxed);
+          if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+          }
+          m_slots[tail & m_mask] = item;
+          m_tail.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+
+        // Consumer side. Returns false if the ring is empty.
+        bool pop(T &item) {
+          size_t head = m_head.load(std::memory_order_relaxed);
+          if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+          }
+          item = m_slots[head & m_mask];
+          m_head.store(head + 1, std::memory_order_release);
+          return true;
+        }
+
+        size_t size() const {
+          return m_tail.load(std::memory_order_acquire) -
+                 m_head.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return m_mask + 1; }
+
+    private:
+        std::vector<T> m_slots;
+        size_t m_mask;
+        std::atomic<size_t> m_head;
+        std::atomic<size_t> m_tail;
+};
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "framebuffer.h"
+#include "ntk_encoder.h"
+
+#include <string.h>
+
+Framebuffer::Framebuffer(uint32_t width, uint32_t height) :
+        m_width(width),
+        m_height(height),
+        m_rows(height / 8),
+        m_valid(false),
+        m_shadow(width * (height / 8), 0) {
+}
+
+void Framebuffer::diff(const uint8_t *frame, bool bseries, std::vector<DirtyRect> &rects,
+                       const uint8_t *columns) const {
+  rects.clear();
+
+  if (!m_valid) {
+    DirtyRect all = { 0, 0, m_width, m_rows };
+    rects.push_back(all);
+    return;
+  }
+
+  bool open = false;
+  DirtyRect current = { 0, 0, 0, 0 };
+
+  for (uint32_t x = 0; x < m_width; x++) {
+    if (columns && !columns[x]) { continue; }
+    const uint8_t *column = frame + x * m_rows;
+    const uint8_t *shadow = &m_shadow[x * m_rows];
+    if (memcmp(column, shadow, m_rows) == 0) { continue; }
+
+    uint32_t first = 0;
+    while (column[first] == shadow[first]) { first++; }
+    uint32_t last = m_rows - 1;
+    while (column[last] == shadow[last]) { last--; }
+
+    DirtyRect next = { x, first, 1, last - first + 1 };
+    if (!open) {
+      current = next;
+      open = true;
+      continue;
+    }
+
+    // Try to grow the current rectangle over to this column, unchanged
+    // columns in between included
+    uint32_t top = current.row < first ? current.row : first;
+    uint32_t bottom = current.row + current.rows - 1;
+    if (last > bottom) { bottom = last; }
+    DirtyRect merged = { current.x, top, x - current.x + 1, bottom - top + 1 };
+
+    size_t apart = ntk_area_size(bseries, m_rows, current.x, current.row, current.width, current.rows)
+                 + ntk_area_size(bseries, m_rows, next.x, next.row, next.width, next.rows);
+    size_t together = ntk_area_size(bseries, m_rows, merged.x, merged.row, merged.width, merged.rows);
+
+    if (together <= apart) {
+      current = merged;
+    } else {
+      rects.push_back(current);
+      current = next;
+    }
+  }
+
+  if (open) { rects.push_back(current); }
+}
+
+size_t Framebuffer::update(const uint8_t *frame, bool bseries, std::vector<uint8_t> &out,
+                           const uint8_t *columns) {
+  diff(frame, bseries, m_rects, columns);
+
+  size_t length = 0;
+  for (size_t i = 0; i < m_rects.size(); i++) {
+    const DirtyRect &r = m_rects[i];
+    length += ntk_area_size(bseries, m_rows, r.x, r.row, r.width, r.rows);
+  }
+
+  out.resize(length);
+  uint8_t *p = length ? &out[0] : NULL;
+  for (size_t i = 0; i < m_rects.size(); i++) {
+    const DirtyRect &r = m_rects[i];
+    p += ntk_area(p, bseries, frame, m_rows, r.x, r.row, r.width, r.rows);
+  }
+
+  memcpy(&m_shadow[0], frame, m_shadow.size());
+  m_valid = true;
+  return length;
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+
+// A changed area of the display, in columns and byte rows
+struct DirtyRect {
+  uint32_t x;
+  uint32_t row;
+  uint32_t width;
+  uint32_t rows;
+};
+
+// Shadow copy of what the display currently shows. Frames handed to update()
+// are diffed against it column by column and only the changed areas are
+// encoded, as Graphic DMA (3900) or real-time bit image (B-series) writes.
+//
+// Frames use the display memory layout from ntk3900.h: column major,
+// height/8 bytes per column.
+class Framebuffer {
+    public:
+        Framebuffer(uint32_t width, uint32_t height);
+
+        uint32_t width() const { return m_width; }
+        uint32_t height() const { return m_height; }
+        size_t size() const { return m_shadow.size(); }
+
+        // Forget the shadow, the next update() sends the whole frame. Safe
+        // to call from any thread.
+        void invalidate() { m_valid = false; }
+
+        // Fills rects with the areas of frame that differ from the shadow.
+        // Neighbouring columns are merged into one rectangle whenever a
+        // single area write is no longer than separate ones. With columns,
+        // one flag per column as filled by Compositor::compose(), only the
+        // flagged columns are compared.
+        void diff(const uint8_t *frame, bool bseries, std::vector<DirtyRect> &rects,
+                  const uint8_t *columns = NULL) const;
+
+        // Encodes the changes in frame into out and makes frame the new
+        // shadow. Returns the encoded length, 0 when nothing changed.
+        size_t update(const uint8_t *frame, bool bseries, std::vector<uint8_t> &out,
+                      const uint8_t *columns = NULL);
+
+    private:
+        uint32_t m_width;
+        uint32_t m_height;
+        uint32_t m_rows;
+        std::atomic<bool> m_valid;
+        std::vector<uint8_t> m_shadow;
+        std::vector<DirtyRect> m_rects;
+};
@@ -0,0 +1,103 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "gpio_map.h"
+#include "bcm2708.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// One mapped peripheral register block
+struct PeripheralMap {
+  off_t base;
+  void *map;
+  int users;
+};
+
+static pthread_mutex_t gpio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t gpio_config = PTHREAD_MUTEX_INITIALIZER;
+static PeripheralMap gpio_block = { GPIO_BASE, NULL, 0 };
+static PeripheralMap spi0_block = { SPI0_BASE, NULL, 0 };
+
+static volatile unsigned *block_acquire(PeripheralMap &block, const char **error) {
+  pthread_mutex_lock(&gpio_lock);
+
+  if (!block.users) {
+    int mem_fd = ::open("/dev/mem", O_RDWR|O_SYNC);
+    if (mem_fd < 0) {
+      pthread_mutex_unlock(&gpio_lock);
+      *error = "can't open /dev/mem";
+      return NULL;
+    }
+
+    void *map = mmap(
+       NULL,             //Any adddress in our space will do
+       BLOCK_SIZE,       //Map length
+       PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
+       MAP_SHARED,       //Shared with other processes
+       mem_fd,           //File to map
+       block.base        //Offset to the peripheral
+    );
+    ::close(mem_fd); //No need to keep mem_fd open after mmap
+
+    if (map == MAP_FAILED) {
+      pthread_mutex_unlock(&gpio_lock);
+      *error = "mmap error";//errno also set!
+      return NULL;
+    }
+    block.map = map;
+  }
+
+  block.users++;
+  volatile unsigned *registers = (volatile unsigned *)block.map;
+  pthread_mutex_unlock(&gpio_lock);
+  return registers;
+}
+
+static void block_release(PeripheralMap &block) {
+  pthread_mutex_lock(&gpio_lock);
+  if (block.users > 0 && --block.users == 0) {
+    munmap(block.map, BLOCK_SIZE);
+    block.map = NULL;
+  }
+  pthread_mutex_unlock(&gpio_lock);
+}
+
+volatile unsigned *gpio_acquire(const char **error) {
+  return block_acquire(gpio_block, error);
+}
+
+void gpio_release() {
+  block_release(gpio_block);
+}
+
+volatile unsigned *spi0_acquire(const char **error) {
+  return block_acquire(spi0_block, error);
+}
+
+void spi0_release() {
+  block_release(spi0_block);
+}
+
+void gpio_config_lock() {
+  pthread_mutex_lock(&gpio_config);
+}
+
+void gpio_config_unlock() {
+  pthread_mutex_unlock(&gpio_config);
+}
@@ -0,0 +1,34 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+// The GPIO registers mapped from /dev/mem, shared by every display in the
+// process. The mapping is made by the first gpio_acquire() and removed by
+// the last gpio_release().
+
+// Returns the register block, or NULL with *error set
+volatile unsigned *gpio_acquire(const char **error);
+void gpio_release();
+
+// The same for the SPI0 controller registers, see spi0.h
+volatile unsigned *spi0_acquire(const char **error);
+void spi0_release();
+
+// Held while changing pin functions and pulls: those are read-modify-write
+// on registers shared between pins
+void gpio_config_lock();
+void gpio_config_unlock();
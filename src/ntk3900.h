@@ -0,0 +1,39 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+// Noritake command bytes shared by the simulator and the encoders.
+//
+// Display memory is column major: each column is height/8 bytes, top to
+// bottom, with the MSB being the topmost pixel. The byte for pixel (x, y)
+// is at x * (height / 8) + y / 8.
+
+#define NTK_WIDTH  256
+#define NTK_HEIGHT 128
+
+// 3900 series Graphic DMA: 02h 44h Ad <command> ...
+#define NTK_DMA_STX        0x02
+#define NTK_DMA_D          0x44
+#define NTK_DMA_ADDRESS    0x00   // Ad, display address
+#define NTK_DMA_BIT_IMAGE  0x46   // aL aH sL sH d(1)...d(s)
+
+// 7000 series and B-series: 1Fh <command> ...
+#define NTK_US             0x1F
+#define NTK_CURSOR_SET     0x24   // xL xH yL yH, y in rows of 8 dots
+#define NTK_EXT            0x28
+#define NTK_EXT_IMAGE      0x66
+#define NTK_EXT_IMAGE_RT   0x11   // xL xH yL yH g d(1)...d(x*y)
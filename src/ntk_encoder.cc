@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "ntk_encoder.h"
+#include "ntk3900.h"
+
+#include <string.h>
+
+size_t ntk_bit_image(uint8_t *out, uint16_t address, const uint8_t *data, uint16_t size) {
+  out[0] = NTK_DMA_STX;
+  out[1] = NTK_DMA_D;
+  out[2] = NTK_DMA_ADDRESS;
+  out[3] = NTK_DMA_BIT_IMAGE;
+  out[4] = address & 0xff;
+  out[5] = address >> 8;
+  out[6] = size & 0xff;
+  out[7] = size >> 8;
+  memcpy(out + NTK_BIT_IMAGE_HEADER, data, size);
+  return NTK_BIT_IMAGE_HEADER + size;
+}
+
+size_t ntk_cursor_set(uint8_t *out, uint32_t x, uint32_t row) {
+  out[0] = NTK_US;
+  out[1] = NTK_CURSOR_SET;
+  out[2] = x & 0xff;
+  out[3] = x >> 8;
+  out[4] = row & 0xff;
+  out[5] = row >> 8;
+  return NTK_CURSOR_SET_SIZE;
+}
+
+size_t ntk_rt_image_header(uint8_t *out, uint32_t width, uint32_t rows) {
+  out[0] = NTK_US;
+  out[1] = NTK_EXT;
+  out[2] = NTK_EXT_IMAGE;
+  out[3] = NTK_EXT_IMAGE_RT;
+  out[4] = width & 0xff;
+  out[5] = width >> 8;
+  out[6] = rows & 0xff;
+  out[7] = rows >> 8;
+  out[8] = 1;  // g
+  return NTK_RT_IMAGE_HEADER;
+}
+
+size_t ntk_window_size(bool bseries, uint32_t display_rows, uint32_t width, uint32_t rows) {
+  if (bseries) {
+    return NTK_CURSOR_SET_SIZE + NTK_RT_IMAGE_HEADER + width * rows;
+  }
+  if (rows == display_rows) {
+    return NTK_BIT_IMAGE_HEADER + width * rows;
+  }
+  return width * (NTK_BIT_IMAGE_HEADER + rows);
+}
+
+size_t ntk_window(uint8_t *out, bool bseries, uint32_t display_rows,
+                  uint32_t x, uint32_t row, uint32_t width, uint32_t rows,
+                  const uint8_t *data) {
+  uint8_t *start = out;
+
+  if (bseries) {
+    out += ntk_cursor_set(out, x, row);
+    out += ntk_rt_image_header(out, width, rows);
+    memcpy(out, data, width * rows);
+    return out + width * rows - start;
+  }
+
+  uint32_t address = x * display_rows + row;
+  if (rows == display_rows) {
+    return ntk_bit_image(out, address, data, width * rows);
+  }
+
+  for (uint32_t c = 0; c < width; c++) {
+    out += ntk_bit_image(out, address, data, rows);
+    address += display_rows;
+    data += rows;
+  }
+  return out - start;
+}
+
+// On the 3900, true if one write over the address span is no longer than
+// one write per column
+static bool area_as_span(uint32_t frame_rows, uint32_t width, uint32_t rows) {
+  size_t span = (width - 1) * frame_rows + rows;
+  return NTK_BIT_IMAGE_HEADER + span <= width * (NTK_BIT_IMAGE_HEADER + rows);
+}
+
+size_t ntk_area_size(bool bseries, uint32_t frame_rows,
+                     uint32_t x, uint32_t row, uint32_t width, uint32_t rows) {
+  if (bseries) {
+    return NTK_CURSOR_SET_SIZE + NTK_RT_IMAGE_HEADER + width * rows;
+  }
+  if (area_as_span(frame_rows, width, rows)) {
+    return NTK_BIT_IMAGE_HEADER + (width - 1) * frame_rows + rows;
+  }
+  return width * (NTK_BIT_IMAGE_HEADER + rows);
+}
+
+size_t ntk_area(uint8_t *out, bool bseries, const uint8_t *frame, uint32_t frame_rows,
+                uint32_t x, uint32_t row, uint32_t width, uint32_t rows) {
+  uint8_t *start = out;
+
+  if (bseries) {
+    out += ntk_cursor_set(out, x, row);
+    out += ntk_rt_image_header(out, width, rows);
+    for (uint32_t c = 0; c < width; c++) {
+      memcpy(out, frame + (x + c) * frame_rows + row, rows);
+      out += rows;
+    }
+    return out - start;
+  }
+
+  uint32_t address = x * frame_rows + row;
+  if (area_as_span(frame_rows, width, rows)) {
+    return ntk_bit_image(out, address, frame + address, (width - 1) * frame_rows + rows);
+  }
+
+  for (uint32_t c = 0; c < width; c++) {
+    out += ntk_bit_image(out, address, frame + address, rows);
+    address += frame_rows;
+  }
+  return out - start;
+}
@@ -0,0 +1,64 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Graphic DMA / bit image command encoders. They write the command header
+// and the payload straight into out, which must be large enough: use the
+// matching _size() function first. All return the number of bytes written.
+//
+// Image data is column major, as described in ntk3900.h.
+
+#define NTK_BIT_IMAGE_HEADER   8   // 02h 44h Ad 46h aL aH sL sH
+#define NTK_CURSOR_SET_SIZE    6   // 1Fh 24h xL xH yL yH
+#define NTK_RT_IMAGE_HEADER    9   // 1Fh 28h 66h 11h xL xH yL yH g
+
+// Display memory address of the byte holding pixel (x, y)
+inline uint32_t ntk_address(uint32_t display_rows, uint32_t x, uint32_t y) {
+  return x * display_rows + y / 8;
+}
+
+// 3900 series: write size bytes at address in display memory
+size_t ntk_bit_image(uint8_t *out, uint16_t address, const uint8_t *data, uint16_t size);
+
+// B-series: move the cursor to column x, byte row row
+size_t ntk_cursor_set(uint8_t *out, uint32_t x, uint32_t row);
+
+// B-series: header of a real-time bit image of width columns and rows byte
+// rows, to be followed by width * rows bytes of data
+size_t ntk_rt_image_header(uint8_t *out, uint32_t width, uint32_t rows);
+
+// Window of width columns and rows byte rows at column x, byte row row, of a
+// display with display_rows byte rows per column. data holds width * rows
+// bytes, column major. One bit image write per column on the 3900, a single
+// one when the window spans whole columns.
+size_t ntk_window_size(bool bseries, uint32_t display_rows, uint32_t width, uint32_t rows);
+size_t ntk_window(uint8_t *out, bool bseries, uint32_t display_rows,
+                  uint32_t x, uint32_t row, uint32_t width, uint32_t rows,
+                  const uint8_t *data);
+
+// Rectangle of width columns and rows byte rows, starting at column x and
+// byte row row, taken from a full column major frame of frame_rows byte rows
+// per column. On the 3900 this is one bit image write per column, or a single
+// write over the whole address span when that is shorter. B-series displays
+// get a cursor set and a real-time bit image.
+size_t ntk_area_size(bool bseries, uint32_t frame_rows,
+                     uint32_t x, uint32_t row, uint32_t width, uint32_t rows);
+size_t ntk_area(uint8_t *out, bool bseries, const uint8_t *frame, uint32_t frame_rows,
+                uint32_t x, uint32_t row, uint32_t width, uint32_t rows);
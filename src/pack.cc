@@ -0,0 +1,170 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "pack.h"
+
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PACK_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PACK_SSE2
+#endif
+
+static inline uint8_t gray_rgba(const uint8_t *p) {
+  return (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+}
+
+// Columns from x to width, one pixel at a time
+static void pack_scalar(uint8_t *out, uint32_t out_rows,
+                        const uint8_t *src, size_t stride, int format,
+                        uint32_t x, uint32_t width, uint32_t band,
+                        const uint8_t threshold[8][16]) {
+  for (; x < width; x++) {
+    uint8_t byte = 0;
+    for (int r = 0; r < 8; r++) {
+      const uint8_t *p = src + (band * 8 + r) * stride + x * format;
+      uint8_t gray = (format == PACK_RGBA) ? gray_rgba(p) : *p;
+      if (gray >= threshold[r][x & 15]) { byte |= 0x80 >> r; }
+    }
+    out[x * out_rows + band] = byte;
+  }
+}
+
+#if defined(PACK_NEON)
+
+// 16 gray levels starting at p
+static inline uint8x16_t load_gray16(const uint8_t *p, int format) {
+  if (format != PACK_RGBA) { return vld1q_u8(p); }
+
+  uint8x16x4_t rgba = vld4q_u8(p);
+  uint16x8_t lo = vmull_u8(vget_low_u8(rgba.val[0]), vdup_n_u8(77));
+  lo = vmlal_u8(lo, vget_low_u8(rgba.val[1]), vdup_n_u8(150));
+  lo = vmlal_u8(lo, vget_low_u8(rgba.val[2]), vdup_n_u8(29));
+  uint16x8_t hi = vmull_u8(vget_high_u8(rgba.val[0]), vdup_n_u8(77));
+  hi = vmlal_u8(hi, vget_high_u8(rgba.val[1]), vdup_n_u8(150));
+  hi = vmlal_u8(hi, vget_high_u8(rgba.val[2]), vdup_n_u8(29));
+  return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+}
+
+// 16 columns of one band of 8 rows
+static inline void pack_block16(uint8_t bytes[16], const uint8_t *src, size_t stride,
+                                int format, const uint8_t threshold[8][16]) {
+  uint8x16_t acc = vdupq_n_u8(0);
+  for (int r = 0; r < 8; r++) {
+    uint8x16_t gray = load_gray16(src + r * stride, format);
+    uint8x16_t lit = vcgeq_u8(gray, vld1q_u8(threshold[r]));
+    acc = vorrq_u8(acc, vandq_u8(lit, vdupq_n_u8(0x80 >> r)));
+  }
+  vst1q_u8(bytes, acc);
+}
+
+#elif defined(PACK_SSE2)
+
+// Gray levels of 4 RGBA pixels, in 32 bit lanes
+static inline __m128i gray_rgba4(const uint8_t *p) {
+  __m128i px = _mm_loadu_si128((const __m128i *)p);
+  __m128i rb = _mm_and_si128(px, _mm_set1_epi32(0x00ff00ff));
+  __m128i ga = _mm_srli_epi16(px, 8);
+  __m128i sum = _mm_add_epi32(_mm_madd_epi16(rb, _mm_set1_epi32((29 << 16) | 77)),
+                              _mm_madd_epi16(ga, _mm_set1_epi32(150)));
+  return _mm_srli_epi32(sum, 8);
+}
+
+static inline __m128i load_gray16(const uint8_t *p, int format) {
+  if (format != PACK_RGBA) { return _mm_loadu_si128((const __m128i *)p); }
+
+  __m128i lo = _mm_packs_epi32(gray_rgba4(p), gray_rgba4(p + 16));
+  __m128i hi = _mm_packs_epi32(gray_rgba4(p + 32), gray_rgba4(p + 48));
+  return _mm_packus_epi16(lo, hi);
+}
+
+static inline void pack_block16(uint8_t bytes[16], const uint8_t *src, size_t stride,
+                                int format, const uint8_t threshold[8][16]) {
+  __m128i acc = _mm_setzero_si128();
+  for (int r = 0; r < 8; r++) {
+    __m128i gray = load_gray16(src + r * stride, format);
+    // gray >= threshold, unsigned
+    __m128i lit = _mm_cmpeq_epi8(_mm_max_epu8(gray, _mm_loadu_si128((const __m128i *)threshold[r])), gray);
+    acc = _mm_or_si128(acc, _mm_and_si128(lit, _mm_set1_epi8((char)(0x80 >> r))));
+  }
+  _mm_storeu_si128((__m128i *)bytes, acc);
+}
+
+#endif
+
+void pack_1bpp(uint8_t *out, uint32_t out_rows,
+               const uint8_t *src, size_t stride, int format,
+               uint32_t width, uint32_t height, const uint8_t threshold[8][16]) {
+  for (uint32_t band = 0; band < height / 8; band++) {
+    uint32_t x = 0;
+
+#if defined(PACK_NEON) || defined(PACK_SSE2)
+    const uint8_t *row = src + band * 8 * stride;
+    uint8_t bytes[16];
+    for (; x + 16 <= width; x += 16) {
+      pack_block16(bytes, row + x * format, stride, format, threshold);
+      uint8_t *column = out + x * out_rows + band;
+      for (int c = 0; c < 16; c++) {
+        column[c * out_rows] = bytes[c];
+      }
+    }
+#endif
+
+    pack_scalar(out, out_rows, src, stride, format, x, width, band, threshold);
+  }
+}
+
+void pack_threshold(uint8_t *out, uint32_t out_rows,
+                    const uint8_t *src, size_t stride, int format,
+                    uint32_t width, uint32_t height, uint8_t threshold) {
+  uint8_t matrix[8][16];
+  memset(matrix, threshold, sizeof(matrix));
+  pack_1bpp(out, out_rows, src, stride, format, width, height, matrix);
+}
+
+void pack_gray_row(uint8_t *dst, const uint8_t *src, int format, uint32_t width) {
+  if (format != PACK_RGBA) {
+    memcpy(dst, src, width);
+    return;
+  }
+
+  uint32_t x = 0;
+#if defined(PACK_NEON)
+  for (; x + 16 <= width; x += 16) {
+    vst1q_u8(dst + x, load_gray16(src + x * format, format));
+  }
+#elif defined(PACK_SSE2)
+  for (; x + 16 <= width; x += 16) {
+    _mm_storeu_si128((__m128i *)(dst + x), load_gray16(src + x * format, format));
+  }
+#endif
+  for (; x < width; x++) {
+    dst[x] = gray_rgba(src + x * format);
+  }
+}
+
+const char *pack_kernel() {
+#if defined(PACK_NEON)
+  return "neon";
+#elif defined(PACK_SSE2)
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
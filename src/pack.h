@@ -0,0 +1,49 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Conversion of canvas pixels to the display memory layout (ntk3900.h):
+// column major, one byte per 8 vertical pixels, MSB on top.
+
+#define PACK_GRAY  1   // bytes per pixel
+#define PACK_RGBA  4
+
+// Packs width x height pixels from src, stride bytes per row, into out.
+// height must be a multiple of 8. The pixel at (x, y) lands in
+// out[x * out_rows + y / 8], so out_rows = height / 8 packs a standalone
+// image, and out_rows = display rows packs into a frame (offset out first).
+//
+// A pixel is lit when its gray level is >= its threshold. threshold holds
+// 8 rows of 16 bytes, applied to each band of 8 rows and repeated every 16
+// columns. RGBA pixels are converted with (77 R + 150 G + 29 B) / 256.
+void pack_1bpp(uint8_t *out, uint32_t out_rows,
+               const uint8_t *src, size_t stride, int format,
+               uint32_t width, uint32_t height, const uint8_t threshold[8][16]);
+
+// Same threshold for every pixel
+void pack_threshold(uint8_t *out, uint32_t out_rows,
+                    const uint8_t *src, size_t stride, int format,
+                    uint32_t width, uint32_t height, uint8_t threshold);
+
+// Gray levels of width pixels of one row
+void pack_gray_row(uint8_t *dst, const uint8_t *src, int format, uint32_t width);
+
+// "neon", "sse2" or "scalar"
+const char *pack_kernel();
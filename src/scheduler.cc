@@ -0,0 +1,84 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "scheduler.h"
+#include "delay.h"
+
+#include <algorithm>
+
+static bool by_device(const InterleaveJob *a, const InterleaveJob *b) {
+  return a->device < b->device;
+}
+
+void interleave(std::vector<InterleaveJob> &jobs) {
+  // Lock the devices in address order, so that two schedulers sharing
+  // displays cannot deadlock
+  std::vector<InterleaveJob *> order;
+  for (size_t i = 0; i < jobs.size(); i++) { order.push_back(&jobs[i]); }
+  std::sort(order.begin(), order.end(), by_device);
+
+  size_t pending = 0;
+  uint64_t start = delay_now_ns();
+  for (size_t i = 0; i < order.size(); i++) {
+    InterleaveJob &job = *order[i];
+    pthread_mutex_lock(&job.device->m_lock);
+    job.sent = 0;
+    if (!job.device->m_open) {
+      job.result = XFER_ERR_CLOSED;
+    } else if (!job.length) {
+      job.result = 0;
+    } else {
+      job.device->interleave_begin();
+      job.result = 0;
+      pending++;
+    }
+  }
+
+  while (pending) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+      InterleaveJob &job = jobs[i];
+      if (job.result < 0 || job.sent == job.length) { continue; }
+      uint64_t now = delay_now_ns();
+      if (!job.device->interleave_ready(now)) {
+        if (job.device->interleave_stalled(now)) {
+          job.device->m_stats.rdy_timeouts.add(1);
+          job.result = XFER_ERR_TIMEOUT;
+          pending--;
+        }
+        continue;
+      }
+
+      int ret = job.device->interleave_send(job.data + job.sent);
+      if (ret < 0) {
+        job.result = ret;
+        pending--;
+        continue;
+      }
+      job.sent++;
+      if (job.sent == job.length) {
+        job.result = job.sent;
+        pending--;
+      }
+    }
+  }
+
+  uint64_t end = delay_now_ns();
+  for (size_t i = order.size(); i-- > 0; ) {
+    InterleaveJob &job = *order[i];
+    job.device->interleave_end(job.result, start, end);
+    pthread_mutex_unlock(&job.device->m_lock);
+  }
+}
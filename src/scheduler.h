@@ -0,0 +1,37 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "spi_device.h"
+
+#include <vector>
+
+// One buffer for one display
+struct InterleaveJob {
+  SpiDevice *device;
+  const char *data;
+  size_t length;
+  size_t sent;
+  int result;   // bytes sent, or an XFER_ERR code
+};
+
+// Sends every job to its display a byte at a time, going round the displays
+// and skipping those still busy with their last byte, so that the time one
+// panel spends BUSY is used to feed the others. The displays share the SPI
+// bus but each has its own chip select and WR/RDY pins. Each device may
+// appear in one job only. Returns once every job is done or failed.
+void interleave(std::vector<InterleaveJob> &jobs);
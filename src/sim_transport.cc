@@ -0,0 +1,409 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "sim_transport.h"
+#include "ntk3900.h"
+#include "delay.h"
+
+#include <string.h>
+#include <time.h>
+
+// How often a sleeping pin_wait() looks at the line again
+#define SIM_WAKEUP_NS 20000
+
+// Decoder states
+enum {
+  SIM_IDLE,
+  SIM_PARAMS,       // collecting m_need parameter bytes, then m_next
+  SIM_DMA_D,
+  SIM_DMA_AD,
+  SIM_DMA_CMD,
+  SIM_DMA_IMAGE,
+  SIM_DMA_DATA,
+  SIM_US,
+  SIM_US_EXT,
+  SIM_US_IMAGE,
+  SIM_US_IMAGE_RT,
+  SIM_US_CURSOR,
+  SIM_RT_DATA
+};
+
+SimTransport::SimTransport() : m_open(false), m_log(NULL), m_spi0_registers(NULL), m_spi0(NULL) {
+  memset(&m_requested, 0, sizeof(m_requested));
+  memset(&m_config, 0, sizeof(m_config));
+  memset(&m_link, 0, sizeof(m_link));
+}
+
+SimTransport::~SimTransport() {
+  delete m_spi0;
+  delete m_spi0_registers;
+}
+
+const char *SimTransport::open(const char *device, const LinkConfig &config) {
+  m_link = config;
+  m_open = true;
+  configure(m_requested);
+  return NULL;
+}
+
+void SimTransport::close() {
+  m_open = false;
+}
+
+// Applies the timing model. Unset fields fall back to what the series
+// datasheets and the transfer code comments describe: a 3900 drops RDY
+// within 500ns, a 7000 raises BUSY up to 20us after the strobe but ~8us is
+// typical.
+void SimTransport::configure(const SimConfig &config) {
+  m_requested = config;
+  m_config = config;
+
+  if (!m_config.width) { m_config.width = NTK_WIDTH; }
+  if (!m_config.height) { m_config.height = NTK_HEIGHT; }
+  if (!m_config.fifo) { m_config.fifo = 1; }
+  if (m_link.invert_rdy) {
+    if (!m_config.busy_delay_ns) { m_config.busy_delay_ns = 8000; }
+    if (!m_config.busy_time_ns) { m_config.busy_time_ns = 5000; }
+  } else {
+    if (!m_config.busy_delay_ns) { m_config.busy_delay_ns = 500; }
+    if (!m_config.busy_time_ns) { m_config.busy_time_ns = 1000; }
+  }
+
+  m_shift = 0;
+  m_latched = 0;
+  m_wr_low = false;
+  m_done_at = 0;
+  m_last_write = 0;
+  m_bytes = 0;
+  m_overruns = 0;
+  m_state = SIM_IDLE;
+  m_cursor_x = 0;
+  m_cursor_y = 0;
+  m_framebuffer.assign(m_config.width * (m_config.height / 8), 0);
+
+  delete m_spi0;
+  delete m_spi0_registers;
+  m_spi0 = NULL;
+  m_spi0_registers = NULL;
+  if (m_config.spi0) {
+    m_spi0_registers = new SimSpi0Registers(*this);
+    m_spi0 = new Spi0Fifo(*m_spi0_registers);
+    m_spi0->setup(0, m_link.mode);
+  }
+}
+
+int SimTransport::message(struct spi_ioc_transfer *segments, unsigned count) {
+  if (!m_open) { return -1; }
+  if (m_spi0) { return m_spi0->message(segments, count); }
+
+  int total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    struct spi_ioc_transfer &segment = segments[i];
+    const uint8_t *tx = (const uint8_t *)(uintptr_t)segment.tx_buf;
+    uint8_t *rx = (uint8_t *)(uintptr_t)segment.rx_buf;
+    uint32_t bits = segment.bits_per_word ? segment.bits_per_word : 8;
+    uint32_t speed = segment.speed_hz ? segment.speed_hz : m_link.max_speed;
+
+    for (uint32_t j = 0; j < segment.len; j++) {
+      shift_in(tx ? tx[j] : 0, speed);
+      if (rx) { rx[j] = 0; }  // Nothing drives MISO
+    }
+
+    // Time on the wire, then the per segment delay
+    delay_ns((uint64_t)segment.len * bits * 1000000000ULL / speed);
+    if (segment.delay_usecs) { delay_ns(segment.delay_usecs * 1000ULL); }
+    total += segment.len;
+
+    // CS goes up between segments with cs_change, and after the last one
+    // without it. That edge latches the 595, and strobes !WR in csStrobe mode.
+    bool last = (i + 1 == count);
+    if (segment.cs_change != last) {
+      chip_select_released();
+    }
+  }
+
+  return total;
+}
+
+void SimTransport::chip_select_released() {
+  m_latched = m_shift;
+  if (m_link.cs_strobe) { display_write(m_latched); }
+}
+
+SimSpi0Registers::SimSpi0Registers(SimTransport &display) :
+        m_display(display),
+        m_cs(0),
+        m_clk(0),
+        m_wire_free(0) {
+}
+
+uint64_t SimSpi0Registers::byte_ns() const {
+  uint32_t divider = m_clk ? m_clk : 65536;
+  return 8ULL * divider * 1000000000ULL / SPI0_CORE_CLOCK;
+}
+
+// Shifts out the bytes whose time on the wire is over. The controller stops
+// while the RX FIFO is full.
+void SimSpi0Registers::advance() {
+  uint64_t now = delay_now_ns();
+  while (!m_tx.empty() && m_rx.size() < SPI0_FIFO_SIZE && now >= m_wire_free + byte_ns()) {
+    m_wire_free += byte_ns();
+    m_display.shift_in(m_tx.front(), SPI0_CORE_CLOCK / (m_clk ? m_clk : 65536));
+    m_tx.pop_front();
+    m_rx.push_back(0);
+  }
+}
+
+uint32_t SimSpi0Registers::read(unsigned reg) {
+  advance();
+  switch (reg) {
+    case SPI0_CS: {
+      uint32_t cs = m_cs;
+      if ((m_cs & SPI0_CS_TA) && m_tx.empty()) { cs |= SPI0_CS_DONE; }
+      if (!m_rx.empty()) { cs |= SPI0_CS_RXD; }
+      if (m_tx.size() < SPI0_FIFO_SIZE) { cs |= SPI0_CS_TXD; }
+      if (m_rx.size() == SPI0_FIFO_SIZE) { cs |= SPI0_CS_RXF; }
+      return cs;
+    }
+    case SPI0_FIFO: {
+      if (m_rx.empty()) { return 0; }
+      uint8_t byte = m_rx.front();
+      m_rx.pop_front();
+      return byte;
+    }
+    case SPI0_CLK:
+      return m_clk;
+    default:
+      return 0;
+  }
+}
+
+void SimSpi0Registers::write(unsigned reg, uint32_t value) {
+  advance();
+  switch (reg) {
+    case SPI0_CS: {
+      if (value & SPI0_CS_CLEAR_TX) { m_tx.clear(); }
+      if (value & SPI0_CS_CLEAR_RX) { m_rx.clear(); }
+      bool was_active = m_cs & SPI0_CS_TA;
+      m_cs = value & (SPI0_CS_CS | SPI0_CS_CPHA | SPI0_CS_CPOL | SPI0_CS_CSPOL | SPI0_CS_TA);
+      if (was_active && !(m_cs & SPI0_CS_TA)) { m_display.chip_select_released(); }
+      break;
+    }
+    case SPI0_FIFO:
+      if (!(m_cs & SPI0_CS_TA) || m_tx.size() == SPI0_FIFO_SIZE) { break; }
+      // Starts shifting right away if the wire is idle
+      if (m_tx.empty()) {
+        uint64_t now = delay_now_ns();
+        if (m_wire_free < now) { m_wire_free = now; }
+      }
+      m_tx.push_back(value);
+      break;
+    case SPI0_CLK:
+      m_clk = value & 0xffff;
+      break;
+  }
+}
+
+void SimTransport::pin_set(uint32_t pin) {
+  if (pin == m_link.wr_pin && !m_link.cs_strobe) {
+    if (m_wr_low) { display_write(m_latched); }
+    m_wr_low = false;
+  }
+}
+
+void SimTransport::pin_clr(uint32_t pin) {
+  if (pin == m_link.wr_pin) {
+    m_wr_low = true;
+  }
+}
+
+bool SimTransport::pin_get(uint32_t pin) {
+  if (pin != m_link.rdy_pin) { return false; }
+
+  bool busy = display_busy(delay_now_ns());
+  return m_link.invert_rdy ? busy : !busy;
+}
+
+int SimTransport::pin_wait(uint32_t pin, bool level, uint64_t timeout_ns) {
+  if (pin != m_link.rdy_pin) { return -1; }
+
+  uint64_t deadline = delay_now_ns() + timeout_ns;
+  for (;;) {
+    if (pin_get(pin) == level) { return 1; }
+
+    uint64_t now = delay_now_ns();
+    if (now >= deadline) { return 0; }
+
+    uint64_t step = deadline - now;
+    if (step > SIM_WAKEUP_NS) { step = SIM_WAKEUP_NS; }
+    struct timespec ts = { 0, (long)step };
+    nanosleep(&ts, NULL);
+  }
+}
+
+void SimTransport::display_write(uint8_t byte) {
+  uint64_t now = delay_now_ns();
+
+  if (display_full(now)) {
+    m_overruns++;
+    return;
+  }
+
+  if (m_done_at < now) { m_done_at = now; }
+  m_done_at += m_config.busy_time_ns;
+  m_last_write = now;
+  m_bytes++;
+  if (m_log) { m_log->push_back(now); }
+
+  decode(byte);
+}
+
+bool SimTransport::display_full(uint64_t now) const {
+  if (m_config.hang_after && m_bytes >= m_config.hang_after) { return true; }
+  if (m_done_at <= now || !m_config.busy_time_ns) { return false; }
+
+  uint64_t pending = (m_done_at - now + m_config.busy_time_ns - 1) / m_config.busy_time_ns;
+  return pending >= m_config.fifo;
+}
+
+// What RDY/BUSY shows: the line only moves busy_delay after the strobe
+bool SimTransport::display_busy(uint64_t now) const {
+  if (now < m_last_write + m_config.busy_delay_ns) { return false; }
+  return display_full(now);
+}
+
+void SimTransport::expect(unsigned count, int next) {
+  m_nparams = 0;
+  m_need = count;
+  m_next = next;
+  m_state = SIM_PARAMS;
+}
+
+void SimTransport::plot_column_byte(uint32_t x, uint32_t row, uint8_t byte) {
+  uint32_t rows = m_config.height / 8;
+  if (x < m_config.width && row < rows) {
+    m_framebuffer[x * rows + row] = byte;
+  }
+}
+
+void SimTransport::decode(uint8_t byte) {
+  bool bseries = m_link.bseries || m_link.invert_rdy;
+
+  switch (m_state) {
+    case SIM_IDLE:
+      if (!bseries && byte == NTK_DMA_STX) { m_state = SIM_DMA_D; }
+      if (bseries && byte == NTK_US) { m_state = SIM_US; }
+      break;
+
+    case SIM_PARAMS:
+      m_params[m_nparams++] = byte;
+      if (m_nparams == m_need) {
+        m_state = m_next;
+        run_command();
+      }
+      break;
+
+    case SIM_DMA_D:
+      m_state = (byte == NTK_DMA_D) ? SIM_DMA_AD : SIM_IDLE;
+      break;
+
+    case SIM_DMA_AD:
+      // We answer to any display address
+      m_state = SIM_DMA_CMD;
+      break;
+
+    case SIM_DMA_CMD:
+      if (byte == NTK_DMA_BIT_IMAGE) {
+        expect(4, SIM_DMA_IMAGE);
+      } else {
+        m_state = SIM_IDLE;
+      }
+      break;
+
+    case SIM_DMA_DATA:
+      m_framebuffer[m_address++ % m_framebuffer.size()] = byte;
+      if (--m_remaining == 0) { m_state = SIM_IDLE; }
+      break;
+
+    case SIM_US:
+      if (byte == NTK_CURSOR_SET) {
+        expect(4, SIM_US_CURSOR);
+      } else if (byte == NTK_EXT) {
+        m_state = SIM_US_EXT;
+      } else {
+        m_state = SIM_IDLE;
+      }
+      break;
+
+    case SIM_US_EXT:
+      m_state = (byte == NTK_EXT_IMAGE) ? SIM_US_IMAGE : SIM_IDLE;
+      break;
+
+    case SIM_US_IMAGE:
+      if (byte == NTK_EXT_IMAGE_RT) {
+        expect(5, SIM_US_IMAGE_RT);
+      } else {
+        m_state = SIM_IDLE;
+      }
+      break;
+
+    case SIM_RT_DATA:
+      plot_column_byte(m_cursor_x + m_image_index / m_image_rows,
+                       m_cursor_y + m_image_index % m_image_rows, byte);
+      m_image_index++;
+      if (--m_remaining == 0) {
+        m_cursor_x += m_image_width;
+        m_state = SIM_IDLE;
+      }
+      break;
+
+    default:
+      m_state = SIM_IDLE;
+      break;
+  }
+}
+
+// Called once all the parameters of a command are in
+void SimTransport::run_command() {
+  switch (m_state) {
+    case SIM_DMA_IMAGE:
+      m_address = m_params[0] | (m_params[1] << 8);
+      m_remaining = m_params[2] | (m_params[3] << 8);
+      // Like the display, ignore what does not fit in display memory
+      if (m_remaining > m_framebuffer.size()) { m_remaining = 0; }
+      m_state = m_remaining ? SIM_DMA_DATA : SIM_IDLE;
+      break;
+
+    case SIM_US_CURSOR:
+      m_cursor_x = m_params[0] | (m_params[1] << 8);
+      m_cursor_y = m_params[2] | (m_params[3] << 8);
+      m_state = SIM_IDLE;
+      break;
+
+    case SIM_US_IMAGE_RT:
+      m_image_width = m_params[0] | (m_params[1] << 8);
+      m_image_rows = m_params[2] | (m_params[3] << 8);
+      m_image_index = 0;
+      m_remaining = m_image_width * m_image_rows;
+      if (m_image_width > m_config.width || m_image_rows > m_config.height / 8) { m_remaining = 0; }
+      m_state = m_remaining ? SIM_RT_DATA : SIM_IDLE;
+      break;
+
+    default:
+      m_state = SIM_IDLE;
+      break;
+  }
+}
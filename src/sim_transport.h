@@ -0,0 +1,151 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "transport.h"
+
+#include <vector>
+#include <deque>
+
+// Timing model of the simulated display. Zero means "use the default for
+// the display series" when the transport is opened.
+struct SimConfig {
+  uint32_t width;
+  uint32_t height;
+  uint32_t busy_delay_ns;  // from the !WR strobe to RDY/BUSY moving
+  uint32_t busy_time_ns;   // time the display needs to process one byte
+  uint32_t fifo;           // bytes the display input buffer can hold
+  uint32_t hang_after;     // bytes after which the display stays busy, 0 never
+  uint32_t spi0;           // send through Spi0Fifo and a simulated controller
+  uint32_t max_clock;      // fastest SPI clock the wiring carries, 0 any
+};
+
+class SimTransport;
+
+// The BCM2835 SPI0 controller as Spi0Fifo sees it: a 16 byte TX and RX FIFO,
+// TA driving the chip select, and bytes leaving at the rate set in SPI0_CLK.
+// What goes out on MOSI is shifted into the simulated display's 74HC595,
+// MISO reads as zeros.
+class SimSpi0Registers : public RegisterFile {
+    public:
+        SimSpi0Registers(SimTransport &display);
+
+        uint32_t read(unsigned reg);
+        void write(unsigned reg, uint32_t value);
+
+    private:
+        void advance();
+        uint64_t byte_ns() const;
+
+        SimTransport &m_display;
+        uint32_t m_cs;
+        uint32_t m_clk;
+        std::deque<uint8_t> m_tx;
+        std::deque<uint8_t> m_rx;
+        uint64_t m_wire_free;   // when the byte being shifted out is done
+};
+
+// In-process NTK3900 stand-in: models the 74HC595, the !WR strobe and the
+// RDY (3900) or BUSY (7000) line with real time latencies, and decodes the
+// Graphic DMA / bit image commands into a framebuffer.
+//
+// Bytes strobed in while the display input buffer is full are dropped and
+// counted as overruns, the same way a real display would garble them. The
+// RDY/BUSY line lags the buffer by busy_delay, so reading it too early after
+// a strobe, with a settle time too short, also ends in overruns.
+//
+// pin_wait() sleeps in short steps, like a thread woken by an edge event.
+class SimTransport : public Transport {
+    public:
+        SimTransport();
+        ~SimTransport();
+
+        const char *name() const { return "sim"; }
+        const char *open(const char *device, const LinkConfig &config);
+        void close();
+        int message(struct spi_ioc_transfer *segments, unsigned count);
+        void pin_set(uint32_t pin);
+        void pin_clr(uint32_t pin);
+        bool pin_get(uint32_t pin);
+        int pin_wait(uint32_t pin, bool level, uint64_t timeout_ns);
+
+        void configure(const SimConfig &config);
+        const SimConfig &requested() const { return m_requested; }
+        const SimConfig &config() const { return m_config; }
+
+        // MOSI byte into the 74HC595 at speed Hz, and the chip select going
+        // up. Above max_clock the 595 samples every bit one clock late.
+        void shift_in(uint8_t byte, uint32_t speed) {
+          if (m_config.max_clock && speed > m_config.max_clock) { byte = (byte >> 1) | (byte & 0x80); }
+          m_shift = byte;
+        }
+        void chip_select_released();
+
+        // When set, the time of every byte the display accepts is appended
+        void record(std::vector<uint64_t> *log) { m_log = log; }
+
+        uint64_t bytes() const { return m_bytes; }
+        uint64_t overruns() const { return m_overruns; }
+        const std::vector<uint8_t> &framebuffer() const { return m_framebuffer; }
+
+    private:
+        void display_write(uint8_t byte);
+        bool display_full(uint64_t now) const;
+        bool display_busy(uint64_t now) const;
+        void decode(uint8_t byte);
+        void expect(unsigned count, int next);
+        void run_command();
+        void plot_column_byte(uint32_t x, uint32_t row, uint8_t byte);
+
+        SimConfig m_requested;
+        SimConfig m_config;
+        LinkConfig m_link;
+        bool m_open;
+
+        // 74HC595 shift and output registers, !WR line level
+        uint8_t m_shift;
+        uint8_t m_latched;
+        bool m_wr_low;
+
+        // Display input buffer: when it will be empty, last accepted write
+        uint64_t m_done_at;
+        uint64_t m_last_write;
+
+        uint64_t m_bytes;
+        uint64_t m_overruns;
+        std::vector<uint64_t> *m_log;
+
+        // Command decoder
+        int m_state;
+        int m_next;
+        uint8_t m_params[8];
+        unsigned m_nparams;
+        unsigned m_need;
+        uint32_t m_address;
+        uint32_t m_remaining;
+        uint32_t m_cursor_x;
+        uint32_t m_cursor_y;
+        uint32_t m_image_width;
+        uint32_t m_image_rows;
+        uint32_t m_image_index;
+
+        std::vector<uint8_t> m_framebuffer;
+
+        // With SimConfig::spi0, message() goes through the FIFO driver
+        SimSpi0Registers *m_spi0_registers;
+        Spi0Fifo *m_spi0;
+};
@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "spi0.h"
+#include "delay.h"
+
+// A byte at the slowest clock takes 2ms; anything much longer is a stuck
+// controller
+#define SPI0_TIMEOUT_NS 100000000ULL
+
+void Spi0Fifo::setup(uint32_t chip_select, uint32_t mode) {
+  m_cs = chip_select & SPI0_CS_CS;
+  if (mode & SPI_CPHA) { m_cs |= SPI0_CS_CPHA; }
+  if (mode & SPI_CPOL) { m_cs |= SPI0_CS_CPOL; }
+  if (mode & SPI_CS_HIGH) { m_cs |= SPI0_CS_CSPOL; }
+  m_divider = 0;
+  m_active = false;
+  m_registers.write(SPI0_CS, m_cs | SPI0_CS_CLEAR_TX | SPI0_CS_CLEAR_RX);
+}
+
+// The divider must be even, and rounds up so that we never go faster than
+// asked. 0 means 65536.
+void Spi0Fifo::set_speed(uint32_t speed) {
+  uint32_t divider = speed ? (SPI0_CORE_CLOCK + speed - 1) / speed : 65536;
+  divider = (divider + 1) & ~1;
+  if (divider < 2) { divider = 2; }
+  if (divider >= 65536) { divider = 0; }
+
+  if (divider != m_divider) {
+    m_registers.write(SPI0_CLK, divider);
+    m_divider = divider;
+  }
+}
+
+int Spi0Fifo::message(struct spi_ioc_transfer *segments, unsigned count) {
+  int total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    struct spi_ioc_transfer &segment = segments[i];
+    const uint8_t *tx = (const uint8_t *)(uintptr_t)segment.tx_buf;
+    uint8_t *rx = (uint8_t *)(uintptr_t)segment.rx_buf;
+
+    set_speed(segment.speed_hz);
+    if (!m_active) {
+      m_registers.write(SPI0_CS, m_cs | SPI0_CS_CLEAR_TX | SPI0_CS_CLEAR_RX);
+      m_registers.write(SPI0_CS, m_cs | SPI0_CS_TA);
+      m_active = true;
+    }
+
+    // Keep the TX FIFO topped up and drain RX as it fills, or the
+    // controller stalls with RX full
+    uint64_t deadline = delay_now_ns() + SPI0_TIMEOUT_NS;
+    uint32_t sent = 0, received = 0;
+    while (received < segment.len) {
+      uint32_t cs = m_registers.read(SPI0_CS);
+      while (sent < segment.len && sent - received < SPI0_FIFO_SIZE && (cs & SPI0_CS_TXD)) {
+        m_registers.write(SPI0_FIFO, tx ? tx[sent] : 0);
+        sent++;
+        cs = m_registers.read(SPI0_CS);
+      }
+      while (received < segment.len && (cs & SPI0_CS_RXD)) {
+        uint8_t byte = m_registers.read(SPI0_FIFO);
+        if (rx) { rx[received] = byte; }
+        received++;
+        cs = m_registers.read(SPI0_CS);
+      }
+      if (received < segment.len && delay_now_ns() > deadline) {
+        release();
+        return -1;
+      }
+    }
+
+    while (!(m_registers.read(SPI0_CS) & SPI0_CS_DONE)) {
+      if (delay_now_ns() > deadline) {
+        release();
+        return -1;
+      }
+    }
+
+    if (segment.delay_usecs) { delay_ns(segment.delay_usecs * 1000ULL); }
+    total += segment.len;
+
+    // Same chip select rule as spidev: up between segments with cs_change,
+    // and after the last one without it
+    bool last = (i + 1 == count);
+    if (segment.cs_change != last) {
+      release();
+    }
+  }
+
+  return total;
+}
+
+void Spi0Fifo::release() {
+  if (!m_active) { return; }
+  m_registers.write(SPI0_CS, m_cs);
+  m_active = false;
+}
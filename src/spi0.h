@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __linux__
+  #include <linux/spi/spidev.h>
+#else
+  #include "fake_spi.h"
+#endif
+
+// BCM2835 SPI0 controller registers, as 32 bit word offsets
+#define SPI0_CS    0
+#define SPI0_FIFO  1
+#define SPI0_CLK   2
+#define SPI0_DLEN  3
+#define SPI0_LTOH  4
+#define SPI0_DC    5
+
+// SPI0_CS bits
+#define SPI0_CS_CS        0x00000003   // chip select 0..2
+#define SPI0_CS_CPHA      0x00000004
+#define SPI0_CS_CPOL      0x00000008
+#define SPI0_CS_CLEAR_TX  0x00000010
+#define SPI0_CS_CLEAR_RX  0x00000020
+#define SPI0_CS_CSPOL     0x00000040   // chip select active high
+#define SPI0_CS_TA        0x00000080   // transfer active, asserts CS
+#define SPI0_CS_DONE      0x00010000
+#define SPI0_CS_RXD       0x00020000   // RX FIFO has data
+#define SPI0_CS_TXD       0x00040000   // TX FIFO has room
+#define SPI0_CS_RXR       0x00080000
+#define SPI0_CS_RXF       0x00100000
+
+#define SPI0_FIFO_SIZE    16
+
+// Core clock the SPI0 divider counts from
+#define SPI0_CORE_CLOCK   250000000
+
+// Access to a block of 32 bit registers: the real ones mapped from /dev/mem,
+// or a simulated controller
+class RegisterFile {
+    public:
+        virtual ~RegisterFile() {}
+        virtual uint32_t read(unsigned reg) = 0;
+        virtual void write(unsigned reg, uint32_t value) = 0;
+};
+
+class MappedRegisters : public RegisterFile {
+    public:
+        MappedRegisters(volatile unsigned *base) : m_base(base) {}
+        uint32_t read(unsigned reg) { return m_base[reg]; }
+        void write(unsigned reg, uint32_t value) { m_base[reg] = value; }
+
+    private:
+        volatile unsigned *m_base;
+};
+
+// Polled SPI0 driver pushing bytes straight into the controller FIFO, with
+// the spidev message contract so that it can stand in for the ioctl. Each
+// segment is clocked out while TA is set, and TA drops (CS goes up) where
+// spidev would release the chip select.
+class Spi0Fifo {
+    public:
+        Spi0Fifo(RegisterFile &registers) : m_registers(registers), m_cs(0), m_divider(0), m_active(false) {}
+
+        // chip_select 0..2, mode is the spidev one
+        void setup(uint32_t chip_select, uint32_t mode);
+
+        // Same contract as ioctl(fd, SPI_IOC_MESSAGE(count), segments)
+        int message(struct spi_ioc_transfer *segments, unsigned count);
+
+        // Drops TA if a message left the chip select asserted
+        void release();
+
+    private:
+        void set_speed(uint32_t speed);
+
+        RegisterFile &m_registers;
+        uint32_t m_cs;        // SPI0_CS without TA and the status bits
+        uint32_t m_divider;
+        bool m_active;
+};
@@ -14,299 +14,1652 @@
     OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
-// #define BUILDING_NODE_EXTENSION
-
 #include "spi_binding.h"
+#include "delay.h"
+#include "ntk_encoder.h"
+#include "pack.h"
+#include "dither.h"
+#include "scheduler.h"
+#include "font.h"
+#include "autotune.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/mman.h>
-#include <sys/time.h>
-
-
-#ifdef __linux__
-  #include <sys/ioctl.h>
-  #include <linux/spi/spidev.h>
-#else
-  #include "fake_spi.h"
-#endif
-#include <node.h>
-#include <node_buffer.h>
-
-using namespace v8;
-using namespace node;
-
-extern "C" {
-  void init (Handle<Object> target) {
-    Spi::Initialize(target);
-  }
-
-  void delayMicrosecondsHard (unsigned int howLong)
- {
-   struct timeval tNow, tLong, tEnd ;
- 
-   gettimeofday (&tNow, NULL) ;
-   tLong.tv_sec  = howLong / 1000000 ;
-   tLong.tv_usec = howLong % 1000000 ;
-   timeradd (&tNow, &tLong, &tEnd) ;
- 
-   while (timercmp (&tNow, &tEnd, <))
-     gettimeofday (&tNow, NULL) ;
- }
-
-  NODE_MODULE(_spi, init)
-}
-
-Persistent<Function> Spi::constructor;
-
-void Spi::Initialize(Handle<Object> target) {
-  Isolate* isolate = Isolate::GetCurrent();
-  HandleScope scope(isolate);
-
-  // var t = function() {};
-  Local<FunctionTemplate> t = FunctionTemplate::New(isolate, New);
-
-  // t = function _spi() {};
-  t->SetClassName(String::NewFromUtf8(isolate, "_spi"));
-  t->InstanceTemplate()->SetInternalFieldCount(1);
-
-  NODE_SET_PROTOTYPE_METHOD(t, "open", Open);
-  NODE_SET_PROTOTYPE_METHOD(t, "close", Close);
-  NODE_SET_PROTOTYPE_METHOD(t, "transfer", Transfer);
-  NODE_SET_PROTOTYPE_METHOD(t, "mode", GetSetMode);
-  NODE_SET_PROTOTYPE_METHOD(t, "chipSelect", GetSetChipSelect);
-  NODE_SET_PROTOTYPE_METHOD(t, "size", GetSetBitsPerWord);
-  NODE_SET_PROTOTYPE_METHOD(t, "bitOrder", GetSetBitOrder);
-  NODE_SET_PROTOTYPE_METHOD(t, "maxSpeed", GetSetMaxSpeed);
-  NODE_SET_PROTOTYPE_METHOD(t, "halfDuplex", GetSet3Wire);
-  NODE_SET_PROTOTYPE_METHOD(t, "delay", GetSetDelay);
-  NODE_SET_PROTOTYPE_METHOD(t, "loopback", GetSetLoop);
-  NODE_SET_PROTOTYPE_METHOD(t, "wrPin", GetSetWrPin);
-  NODE_SET_PROTOTYPE_METHOD(t, "rdyPin", GetSetRdyPin);
-  NODE_SET_PROTOTYPE_METHOD(t, "invertRdy", GetSetInvertRdy);
-  NODE_SET_PROTOTYPE_METHOD(t, "bSeries", GetSetbSeries);
-
-  // var constructor = t; // in context of new.
-  constructor.Reset(isolate, t->GetFunction());
-
-  // exports._spi = constructor;
-  target->Set(String::NewFromUtf8(isolate, "_spi"), t->GetFunction());
-
-  NODE_DEFINE_CONSTANT(target, SPI_MODE_0);
-  NODE_DEFINE_CONSTANT(target, SPI_MODE_1);
-  NODE_DEFINE_CONSTANT(target, SPI_MODE_2);
-  NODE_DEFINE_CONSTANT(target, SPI_MODE_3);
+#include <math.h>
 
-#define SPI_CS_LOW 0  // This doesn't exist normally
-  NODE_DEFINE_CONSTANT(target, SPI_NO_CS);
-  NODE_DEFINE_CONSTANT(target, SPI_CS_HIGH);
-  NODE_DEFINE_CONSTANT(target, SPI_CS_LOW);
+// Context aware: every environment loading the addon, the main thread and
+// each worker_thread, gets its own class and fonts through Initialize()
+NAPI_MODULE_INIT() {
+  return Spi::Initialize(env, exports);
+}
+
+/*********************************************************************************************************************
+
+Values */
+
+static napi_value js_number(napi_env env, double value) {
+  napi_value result;
+  napi_create_double(env, value, &result);
+  return result;
+}
+
+static napi_value js_int(napi_env env, int32_t value) {
+  napi_value result;
+  napi_create_int32(env, value, &result);
+  return result;
+}
+
+static napi_value js_uint(napi_env env, uint32_t value) {
+  napi_value result;
+  napi_create_uint32(env, value, &result);
+  return result;
+}
+
+static napi_value js_bool(napi_env env, bool value) {
+  napi_value result;
+  napi_get_boolean(env, value, &result);
+  return result;
+}
+
+static napi_value js_string(napi_env env, const char *value, size_t length = NAPI_AUTO_LENGTH) {
+  napi_value result;
+  napi_create_string_utf8(env, value, length, &result);
+  return result;
+}
+
+static napi_value js_null(napi_env env) {
+  napi_value result;
+  napi_get_null(env, &result);
+  return result;
+}
+
+static napi_value js_undefined(napi_env env) {
+  napi_value result;
+  napi_get_undefined(env, &result);
+  return result;
+}
+
+static napi_value js_object(napi_env env) {
+  napi_value result;
+  napi_create_object(env, &result);
+  return result;
+}
+
+static napi_value js_array(napi_env env, uint32_t length = 0) {
+  napi_value result;
+  napi_create_array_with_length(env, length, &result);
+  return result;
+}
+
+static napi_value js_error(napi_env env, const char *message) {
+  napi_value result;
+  napi_create_error(env, NULL, js_string(env, message), &result);
+  return result;
+}
+
+static void set_property(napi_env env, napi_value object, const char *name, napi_value value) {
+  napi_set_named_property(env, object, name, value);
+}
+
+static napi_value get_property(napi_env env, napi_value object, const char *name) {
+  napi_value result;
+  if (napi_get_named_property(env, object, name, &result) != napi_ok) { return js_undefined(env); }
+  return result;
+}
+
+static void set_element(napi_env env, napi_value array, uint32_t index, napi_value value) {
+  napi_set_element(env, array, index, value);
+}
+
+static napi_value get_element(napi_env env, napi_value array, uint32_t index) {
+  napi_value result;
+  if (napi_get_element(env, array, index, &result) != napi_ok) { return js_undefined(env); }
+  return result;
+}
+
+static uint32_t array_length(napi_env env, napi_value array) {
+  uint32_t length = 0;
+  napi_get_array_length(env, array, &length);
+  return length;
+}
+
+static napi_valuetype type_of(napi_env env, napi_value value) {
+  napi_valuetype type = napi_undefined;
+  napi_typeof(env, value, &type);
+  return type;
+}
+
+static bool is_array(napi_env env, napi_value value) {
+  bool result = false;
+  napi_is_array(env, value, &result);
+  return result;
+}
+
+// Numbers that are whole and in range, like v8's IsInt32() and IsUint32()
+static bool is_int32(napi_env env, napi_value value) {
+  double number;
+  if (napi_get_value_double(env, value, &number) != napi_ok) { return false; }
+  return number >= INT32_MIN && number <= INT32_MAX && number == floor(number);
+}
+
+static bool is_uint32(napi_env env, napi_value value) {
+  double number;
+  if (napi_get_value_double(env, value, &number) != napi_ok) { return false; }
+  return number >= 0 && number <= UINT32_MAX && number == floor(number);
+}
+
+// Any value, converted the way JS converts it
+static int32_t int32_value(napi_env env, napi_value value) {
+  int32_t result = 0;
+  if (napi_coerce_to_number(env, value, &value) == napi_ok) { napi_get_value_int32(env, value, &result); }
+  return result;
+}
+
+static uint32_t uint32_value(napi_env env, napi_value value) {
+  uint32_t result = 0;
+  if (napi_coerce_to_number(env, value, &value) == napi_ok) { napi_get_value_uint32(env, value, &result); }
+  return result;
+}
+
+static bool bool_value(napi_env env, napi_value value) {
+  bool result = false;
+  if (napi_coerce_to_bool(env, value, &value) == napi_ok) { napi_get_value_bool(env, value, &result); }
+  return result;
+}
+
+static std::string utf8_value(napi_env env, napi_value value) {
+  size_t length = 0;
+  if (napi_coerce_to_string(env, value, &value) != napi_ok ||
+      napi_get_value_string_utf8(env, value, NULL, 0, &length) != napi_ok) {
+    return std::string();
+  }
+  std::string result(length + 1, '\0');
+  napi_get_value_string_utf8(env, value, &result[0], result.size(), &length);
+  result.resize(length);
+  return result;
+}
+
+static bool is_buffer(napi_env env, napi_value value) {
+  bool result = false;
+  napi_is_buffer(env, value, &result);
+  return result;
+}
+
+static char *buffer_data(napi_env env, napi_value value) {
+  void *data = NULL;
+  napi_get_buffer_info(env, value, &data, NULL);
+  return (char *)data;
+}
+
+static size_t buffer_length(napi_env env, napi_value value) {
+  size_t length = 0;
+  napi_get_buffer_info(env, value, NULL, &length);
+  return length;
+}
+
+static napi_value new_buffer(napi_env env, size_t size) {
+  void *data;
+  napi_value result;
+  napi_create_buffer(env, size, &data, &result);
+  return result;
+}
+
+/*********************************************************************************************************************
+
+Environment and object lifetime */
+
+#define SPI_METHOD(NAME, FUNC) \
+  { NAME, NULL, FUNC, NULL, NULL, NULL, (napi_property_attributes)(napi_writable | napi_configurable), NULL }
+#define SPI_EXPORT(NAME, FUNC) \
+  { NAME, NULL, FUNC, NULL, NULL, NULL, (napi_property_attributes)(napi_writable | napi_enumerable | napi_configurable), NULL }
+#define SPI_CONSTANT(NAME) \
+  { #NAME, NULL, NULL, NULL, NULL, js_int(env, NAME), napi_enumerable, NULL }
+
+static AddonData *addon_data(napi_env env) {
+  AddonData *data = NULL;
+  napi_get_instance_data(env, (void **)&data);
+  return data;
+}
+
+static void free_addon_data(napi_env env, void *data, void *hint) {
+  AddonData *addon = static_cast<AddonData *>(data);
+  napi_delete_reference(env, addon->constructor);
+  for (size_t i = 0; i < addon->fonts.size(); i++) { delete addon->fonts[i]; }
+  delete addon;
+}
+
+CallArgs::CallArgs(napi_env env, napi_callback_info info) {
+  m_length = SPI_MAX_ARGS;
+  napi_get_cb_info(env, info, &m_length, m_argv, &m_this, NULL);
+  if (m_length > SPI_MAX_ARGS) { m_length = SPI_MAX_ARGS; }
+  napi_get_undefined(env, &m_undefined);
+}
+
+napi_value Spi::Initialize(napi_env env, napi_value exports) {
+  napi_property_descriptor methods[] = {
+    SPI_METHOD("open", Open),
+    SPI_METHOD("close", Close),
+    SPI_METHOD("transfer", Transfer),
+    SPI_METHOD("transferv", Transferv),
+    SPI_METHOD("queue", Queue),
+    SPI_METHOD("flush", Flush),
+    SPI_METHOD("mode", GetSetMode),
+    SPI_METHOD("chipSelect", GetSetChipSelect),
+    SPI_METHOD("size", GetSetBitsPerWord),
+    SPI_METHOD("bitOrder", GetSetBitOrder),
+    SPI_METHOD("maxSpeed", GetSetMaxSpeed),
+    SPI_METHOD("halfDuplex", GetSet3Wire),
+    SPI_METHOD("delay", GetSetDelay),
+    SPI_METHOD("loopback", GetSetLoop),
+    SPI_METHOD("wrPin", GetSetWrPin),
+    SPI_METHOD("rdyPin", GetSetRdyPin),
+    SPI_METHOD("csStrobe", GetSetCsStrobe),
+    SPI_METHOD("invertRdy", GetSetInvertRdy),
+    SPI_METHOD("bSeries", GetSetbSeries),
+    SPI_METHOD("burst", GetSetBurst),
+    SPI_METHOD("settle", GetSetSettle),
+    SPI_METHOD("rdySpin", GetSetRdySpin),
+    SPI_METHOD("rdyTimeout", GetSetRdyTimeout),
+    SPI_METHOD("timing", Timing),
+    SPI_METHOD("autotune", Autotune),
+    SPI_METHOD("stats", Stats),
+    SPI_METHOD("resetStats", ResetStats),
+    SPI_METHOD("trace", Trace),
+    SPI_METHOD("traceJson", TraceJson),
+    SPI_METHOD("transport", GetSetTransport),
+    SPI_METHOD("dataPins", GetSetDataPins),
+    SPI_METHOD("simulator", Simulator),
+    SPI_METHOD("engineStart", EngineStart),
+    SPI_METHOD("engineStop", EngineStop),
+    SPI_METHOD("engineStatus", EngineStatus),
+    SPI_METHOD("submit", Submit),
+    SPI_METHOD("present", Present),
+    SPI_METHOD("framebuffer", SetFramebuffer),
+    SPI_METHOD("commit", Commit),
+    SPI_METHOD("invalidate", Invalidate),
+    SPI_METHOD("addLayer", AddLayer),
+    SPI_METHOD("removeLayer", RemoveLayer),
+    SPI_METHOD("layerBitmap", LayerBitmap),
+    SPI_METHOD("moveLayer", MoveLayer),
+    SPI_METHOD("layer", Layer),
+    SPI_METHOD("compose", Compose),
+    SPI_METHOD("commitLayers", CommitLayers),
+    SPI_METHOD("address", Address),
+    SPI_METHOD("encodeBitImage", EncodeBitImage),
+    SPI_METHOD("encodeWindow", EncodeWindow),
+    SPI_METHOD("writeBitImage", WriteBitImage),
+    SPI_METHOD("writeWindow", WriteWindow),
+    SPI_METHOD("pack", Pack),
+    SPI_METHOD("dither", Dither),
+    SPI_METHOD("text", Text)
+  };
+
+  napi_value constructor;
+  if (napi_define_class(env, "_spi", NAPI_AUTO_LENGTH, New, NULL,
+                        sizeof(methods) / sizeof(methods[0]), methods, &constructor) != napi_ok) {
+    return NULL;
+  }
+
+  // The class and the fonts of this environment, freed when it goes away
+  AddonData *data = new AddonData();
+  napi_create_reference(env, constructor, 1, &data->constructor);
+  data->fonts.push_back(Font::builtin());
+  napi_set_instance_data(env, data, free_addon_data, NULL);
 
+#define SPI_CS_LOW 0  // This doesn't exist normally
 #define SPI_MSB false
 #define SPI_LSB true
-  NODE_DEFINE_CONSTANT(target, SPI_MSB);
-  NODE_DEFINE_CONSTANT(target, SPI_LSB);
 
+  napi_property_descriptor module[] = {
+    { "_spi", NULL, NULL, NULL, NULL, constructor, napi_enumerable, NULL },
+    SPI_EXPORT("interleave", Interleave),
+    SPI_EXPORT("loadFont", LoadFont),
+    SPI_EXPORT("textWidth", TextWidth),
+
+    SPI_CONSTANT(SPI_MODE_0),
+    SPI_CONSTANT(SPI_MODE_1),
+    SPI_CONSTANT(SPI_MODE_2),
+    SPI_CONSTANT(SPI_MODE_3),
+
+    SPI_CONSTANT(SPI_NO_CS),
+    SPI_CONSTANT(SPI_CS_HIGH),
+    SPI_CONSTANT(SPI_CS_LOW),
+
+    SPI_CONSTANT(SPI_MSB),
+    SPI_CONSTANT(SPI_LSB),
+
+    SPI_CONSTANT(BLEND_OR),
+    SPI_CONSTANT(BLEND_AND),
+    SPI_CONSTANT(BLEND_XOR),
+
+    SPI_CONSTANT(TEXT_OR),
+    SPI_CONSTANT(TEXT_REPLACE),
+    SPI_CONSTANT(TEXT_INVERT)
+  };
+  napi_define_properties(env, exports, sizeof(module) / sizeof(module[0]), module);
+
+  return exports;
 }
 
 // new Spi(string device)
-//Handle<Value> Spi::New(const FunctionCallbackInfo<Value>& args) {
 SPI_FUNC_IMPL(New) {
-  Isolate *isolate = args.GetIsolate();
-  HandleScope scope(isolate);
+  CallArgs args(env, info);
+
+  napi_value target = NULL;
+  napi_get_new_target(env, info, &target);
+  if (!target) {
+    napi_value constructor, instance;
+    napi_get_reference_value(env, addon_data(env)->constructor, &constructor);
+    napi_new_instance(env, constructor, 0, NULL, &instance);
+    return instance;
+  }
+
+  Spi* spi = new Spi(env);
+  if (napi_wrap(env, args.This(), spi, Finalize, NULL, &spi->m_wrapper) != napi_ok) {
+    delete spi;
+    return NULL;
+  }
+  return args.This();
+}
+
+void Spi::Finalize(napi_env env, void *data, void *hint) {
+  Spi *spi = static_cast<Spi *>(data);
+  napi_delete_reference(env, spi->m_wrapper);
+  delete spi;
+}
+
+Spi *Spi::unwrap(napi_env env, napi_value object) {
+  Spi *spi = NULL;
+  if (napi_unwrap(env, object, (void **)&spi) != napi_ok || !spi) {
+    EXCEPTION("Not an _spi object");
+    return NULL;
+  }
+  return spi;
+}
+
+void Spi::Ref() {
+  napi_reference_ref(m_env, m_wrapper, NULL);
+}
+
+void Spi::Unref() {
+  napi_reference_unref(m_env, m_wrapper, NULL);
+}
+
+/*********************************************************************************************************************
+
+Work on the thread pool */
+
+// Sets up work for the thread pool of the calling environment; schedule()
+// queues it. Nothing in work may call into JS; after runs on the JS thread
+// once it is done.
+static void create_work(napi_env env, const char *name, AsyncJob &job,
+                        napi_async_execute_callback work, napi_async_complete_callback after,
+                        void *baton) {
+  napi_create_async_work(env, NULL, js_string(env, name), work, after, baton, &job.request);
+}
+
+// The thread pool runs work in no particular order and a transfer only
+// holds the device for its own bytes, so two writes queued straight away
+// could reach the display swapped. Each device keeps its async calls in a
+// queue instead and hands the pool one at a time.
+void Spi::schedule(napi_env env, AsyncJob &job, const std::vector<Spi *> &devices) {
+  job.waiting = devices.size();
+  for (size_t i = 0; i < devices.size(); i++) {
+    devices[i]->m_jobs.push_back(&job);
+    if (devices[i]->m_jobs.size() == 1) { job.waiting--; }
+  }
+  if (job.waiting == 0) { napi_queue_async_work(env, job.request); }
+}
+
+void Spi::finish(napi_env env, AsyncJob &job, const std::vector<Spi *> &devices) {
+  for (size_t i = 0; i < devices.size(); i++) {
+    std::deque<AsyncJob *> &jobs = devices[i]->m_jobs;
+    jobs.pop_front();
+    if (!jobs.empty() && --jobs.front()->waiting == 0) {
+      napi_queue_async_work(env, jobs.front()->request);
+    }
+  }
+  napi_delete_async_work(env, job.request);
+}
+
+// Keeps a JS value alive until released
+static napi_ref keep(napi_env env, napi_value value) {
+  napi_ref ref = NULL;
+  napi_create_reference(env, value, 1, &ref);
+  return ref;
+}
+
+static void release(napi_env env, napi_ref &ref) {
+  if (ref) {
+    napi_delete_reference(env, ref);
+    ref = NULL;
+  }
+}
+
+// Calls the callback a baton kept, and lets go of it
+static void call_back(napi_env env, napi_ref &callback, size_t argc, napi_value *argv) {
+  napi_value function, global;
+  napi_get_reference_value(env, callback, &function);
+  napi_get_global(env, &global);
+  release(env, callback);
+
+  napi_call_function(env, global, function, argc, argv, NULL);
+}
+
+/*********************************************************************************************************************
+
+Methods */
+
+// TODO: Make Non-blocking once basic functionality is proven
+SPI_FUNC_IMPL(Open) {
+  FUNCTION_PREAMBLE;
+  if (!self->require_arguments(env, args, 1)) { return NULL; }
+  ASSERT_NOT_OPEN;
+
+  std::string device = utf8_value(env, args[0]);
+
+  const char *error = self->open(device.c_str());
+  if (error) {
+    EXCEPTION(error);
+    return NULL;
+  }
+
+  FUNCTION_CHAIN;
+}
+
+SPI_FUNC_IMPL(Close) {
+  FUNCTION_PREAMBLE;
+  ONLY_IF_OPEN;
+
+  // The transmit engine holds a reference until it is stopped
+  bool engine_running = self->m_engine_running;
+  self->close();
+  if (engine_running) { self->Unref(); }
+
+  FUNCTION_CHAIN;
+}
+
+// State of a transfer queued on the thread pool. The JS buffers are kept
+// alive through the references until the callback runs.
+struct TransferBaton {
+  AsyncJob job;
+  Spi *self;
+  char *write;
+  char *read;
+  size_t length;
+  int result;
+  napi_ref write_obj;
+  napi_ref read_obj;
+  napi_ref callback;
+  std::vector<uint8_t> frame;     // commit(): a copy of the frame
+  std::vector<uint8_t> changed;   // commitLayers(): columns changed in it
+  std::vector<uint8_t> encoded;   // commit(): the encoded changes
+  std::vector<TxSegment> segments;   // transferv(): the gather list
+  bool flush;                        // flush(): send the command queue
+};
+
+// Bytes per element of each napi_typedarray_type, in order
+static const size_t typed_array_sizes[] = { 1, 1, 1, 2, 2, 4, 4, 4, 8, 8, 8 };
+
+// A Buffer, any TypedArray or DataView, or an ArrayBuffer: where its bytes
+// are, used in place
+static bool get_bytes(napi_env env, napi_value value, char*& data, size_t& length) {
+  bool is = false;
+  void *bytes = NULL;
+  if (is_buffer(env, value)) {
+    data = buffer_data(env, value);
+    length = buffer_length(env, value);
+    return true;
+  }
+  if (napi_is_typedarray(env, value, &is) == napi_ok && is) {
+    napi_typedarray_type type;
+    size_t elements;
+    napi_get_typedarray_info(env, value, &type, &elements, &bytes, NULL, NULL);
+    size_t size = (size_t)type < sizeof(typed_array_sizes) / sizeof(typed_array_sizes[0])
+                ? typed_array_sizes[type] : 1;
+    data = (char *)bytes;
+    length = elements * size;
+    return true;
+  }
+  if (napi_is_dataview(env, value, &is) == napi_ok && is) {
+    napi_get_dataview_info(env, value, &length, &bytes, NULL, NULL);
+    data = (char *)bytes;
+    return true;
+  }
+  if (napi_is_arraybuffer(env, value, &is) == napi_ok && is) {
+    napi_get_arraybuffer_info(env, value, &bytes, &length);
+    data = (char *)bytes;
+    return true;
+  }
+  return false;
+}
+
+// tranfer(write_buffer, read_buffer[, callback]);
+//
+// Without a callback the transfer blocks the JS thread and returns the number
+// of bytes sent. With a callback it runs on the thread pool and the callback
+// is called as callback(err, bytes) once it is done.
+//
+// Either buffer may be null: nothing is read back, or zeros are written.
+// Buffers, TypedArrays and ArrayBuffers are used in place.
+SPI_FUNC_IMPL(Transfer) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+    if (!self->require_arguments(env, args, 2)) { return NULL; }
+
+  bool write_null = type_of(env, args[0]) == napi_null;
+  bool read_null = type_of(env, args[1]) == napi_null;
+  if (write_null && read_null) {
+    EXCEPTION("Both buffers cannot be null");
+    return NULL;
+  }
+
+  char *write_buffer = NULL;
+  char *read_buffer = NULL;
+  size_t write_length = 0;
+  size_t read_length = 0;
+
+  if (!write_null) {
+    if (!get_bytes(env, args[0], write_buffer, write_length)) {
+      EXCEPTION("Write buffer must be a Buffer, TypedArray or ArrayBuffer");
+      return NULL;
+    }
+  }
+
+  if (!read_null) {
+    if (!get_bytes(env, args[1], read_buffer, read_length)) {
+      EXCEPTION("Read buffer must be a Buffer, TypedArray or ArrayBuffer");
+      return NULL;
+    }
+  }
+
+  if (!write_null && !read_null && write_length != read_length) {
+    EXCEPTION("Read and write buffers MUST be the same length");
+    return NULL;
+  }
+
+  if (type_of(env, args[2]) == napi_function) {
+    TransferBaton *baton = new TransferBaton();
+    baton->self = self;
+    baton->write = write_buffer;
+    baton->read = read_buffer;
+    baton->length = MAX(write_length, read_length);
+    baton->result = 0;
+    if (!write_null) { baton->write_obj = keep(env, args[0]); }
+    if (!read_null) { baton->read_obj = keep(env, args[1]); }
+    baton->callback = keep(env, args[2]);
+
+    // Keep the Spi object alive until the transfer is done
+    self->Ref();
+    create_work(env, "spi.transfer", baton->job, transfer_work, transfer_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  int ret = self->transfer(write_buffer, read_buffer,
+                           MAX(write_length, read_length));
+
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
+
+  return js_int(env, ret);
+}
+
+// transferv([buffer, ...][, callback])
+//
+// Writes the buffers back to back as one transfer, without joining them
+// first. Nothing is read back. Returns like transfer().
+SPI_FUNC_IMPL(Transferv) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+
+  if (args.Length() < 1 || !is_array(env, args[0])) {
+    EXCEPTION("Expected an array of buffers");
+    return NULL;
+  }
+  napi_value buffers = args[0];
+
+  std::vector<TxSegment> segments(array_length(env, buffers));
+  size_t length = 0;
+  for (uint32_t i = 0; i < segments.size(); i++) {
+    char *data;
+    size_t size;
+    if (!get_bytes(env, get_element(env, buffers, i), data, size)) {
+      EXCEPTION("Buffers must be Buffers, TypedArrays or ArrayBuffers");
+      return NULL;
+    }
+    segments[i].data = data;
+    segments[i].length = size;
+    length += size;
+  }
+
+  if (type_of(env, args[1]) == napi_function) {
+    TransferBaton *baton = new TransferBaton();
+    baton->self = self;
+    baton->write = NULL;
+    baton->read = NULL;
+    baton->length = length;
+    baton->result = 0;
+    baton->segments.swap(segments);
+    // The array keeps the buffers alive
+    baton->write_obj = keep(env, buffers);
+    baton->callback = keep(env, args[1]);
+
+    self->Ref();
+    create_work(env, "spi.transferv", baton->job, transfer_work, transfer_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  int ret = self->transferv(segments.empty() ? NULL : &segments[0], segments.size());
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
+
+  return js_int(env, ret);
+}
+
+// queue(buffer)
+//
+// Adds one command, or a short run of text, to the command queue. Nothing
+// is sent until flush(). A brightness, cursor or font command must be a
+// whole buffer on its own to be recognised and left out when redundant.
+SPI_FUNC_IMPL(Queue) {
+  FUNCTION_PREAMBLE;
+  if (!self->require_arguments(env, args, 1)) { return NULL; }
+
+  char *data;
+  size_t length;
+  if (!get_bytes(env, args[0], data, length)) {
+    EXCEPTION("Command must be a Buffer, TypedArray or ArrayBuffer");
+    return NULL;
+  }
+
+  self->queue_command((const uint8_t *)data, length);
+
+  FUNCTION_CHAIN;
+}
+
+// flush([callback])
+//
+// Sends the command queue as one transfer. Returns the number of bytes sent,
+// or passes it to callback when the transfer runs on the thread pool.
+SPI_FUNC_IMPL(Flush) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+
+  if (type_of(env, args[0]) == napi_function) {
+    TransferBaton *baton = new TransferBaton();
+    baton->self = self;
+    baton->write = NULL;
+    baton->read = NULL;
+    baton->length = 0;
+    baton->result = 0;
+    baton->flush = true;
+    baton->callback = keep(env, args[0]);
+
+    self->Ref();
+    create_work(env, "spi.flush", baton->job, transfer_work, transfer_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  int ret = self->flush();
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
+
+  return js_int(env, ret);
+}
+
+// Runs on the thread pool: no JS calls allowed in here.
+void Spi::transfer_work(napi_env env, void *data) {
+  TransferBaton *baton = static_cast<TransferBaton *>(data);
+  if (baton->flush) {
+    baton->result = baton->self->flush();
+  } else if (!baton->segments.empty()) {
+    baton->result = baton->self->transferv(&baton->segments[0], baton->segments.size());
+  } else if (!baton->frame.empty()) {
+    baton->result = baton->self->commit(&baton->frame[0], baton->frame.size(), baton->encoded,
+                                        baton->changed.empty() ? NULL : &baton->changed[0]);
+  } else {
+    baton->result = baton->self->transfer(baton->write, baton->read, baton->length);
+  }
+}
+
+void Spi::transfer_after(napi_env env, napi_status status, void *data) {
+  TransferBaton *baton = static_cast<TransferBaton *>(data);
+
+  napi_value argv[2];
+  if (baton->result < 0) {
+    argv[0] = js_error(env, SpiDevice::transfer_error(baton->result));
+    argv[1] = js_undefined(env);
+  } else {
+    argv[0] = js_null(env);
+    argv[1] = js_int(env, baton->result);
+  }
+
+  release(env, baton->write_obj);
+  release(env, baton->read_obj);
+  baton->self->finish(env, baton->job);
+
+  call_back(env, baton->callback, 2, argv);
+
+  baton->self->Unref();
+  delete baton;
+}
+
+struct InterleaveBaton {
+  AsyncJob job;
+  std::vector<InterleaveJob> jobs;
+  std::vector<Spi *> devices;
+  napi_ref buffers;
+  napi_ref callback;
+};
+
+// [bytes, ...] and the error of the first display that failed, if any
+static napi_value interleave_results(napi_env env, const std::vector<InterleaveJob> &jobs,
+                                     napi_value &results) {
+  napi_value error = NULL;
+  results = js_array(env, jobs.size());
+  for (size_t i = 0; i < jobs.size(); i++) {
+    set_element(env, results, i, js_int(env, jobs[i].result < 0 ? 0 : jobs[i].result));
+    if (jobs[i].result < 0 && !error) {
+      error = js_error(env, SpiDevice::transfer_error(jobs[i].result));
+    }
+  }
+  return error ? error : js_null(env);
+}
+
+// interleave([spi, ...], [buffer, ...][, callback])
+//
+// Sends each buffer to the display at the same index, a byte at a time,
+// feeding another display whenever one is busy. Returns the bytes sent to
+// each display, or passes (err, [bytes, ...]) to callback when it runs on
+// the thread pool.
+SPI_FUNC_IMPL(Interleave) {
+  CallArgs args(env, info);
+
+  if (args.Length() < 2 || !is_array(env, args[0]) || !is_array(env, args[1])) {
+    EXCEPTION("Expected an array of devices and an array of buffers");
+    return NULL;
+  }
+  napi_value devices = args[0];
+  napi_value buffers = args[1];
+  uint32_t count = array_length(env, devices);
+  if (count == 0 || count != array_length(env, buffers)) {
+    EXCEPTION("Expected one buffer per device");
+    return NULL;
+  }
+
+  napi_value constructor;
+  napi_get_reference_value(env, addon_data(env)->constructor, &constructor);
+  std::vector<InterleaveJob> jobs;
+  std::vector<Spi *> spis;
+  for (uint32_t i = 0; i < count; i++) {
+    napi_value device = get_element(env, devices, i);
+    napi_value buffer = get_element(env, buffers, i);
+    bool instance = false;
+    if (type_of(env, device) != napi_object ||
+        napi_instanceof(env, device, constructor, &instance) != napi_ok || !instance) {
+      EXCEPTION("Devices must be _spi objects");
+      return NULL;
+    }
+    if (!is_buffer(env, buffer)) {
+      EXCEPTION("Buffers must be Buffers");
+      return NULL;
+    }
+
+    Spi *self = Spi::unwrap(env, device);
+    if (!self) { return NULL; }
+    for (size_t j = 0; j < spis.size(); j++) {
+      if (spis[j] == self) {
+        EXCEPTION("Each device may only appear once");
+        return NULL;
+      }
+    }
+    ASSERT_OPEN;
+    spis.push_back(self);
+
+    InterleaveJob job = { self, buffer_data(env, buffer), buffer_length(env, buffer), 0, 0 };
+    jobs.push_back(job);
+  }
+
+  if (type_of(env, args[2]) == napi_function) {
+    InterleaveBaton *baton = new InterleaveBaton();
+    baton->jobs = jobs;
+    baton->devices = spis;
+    baton->buffers = keep(env, buffers);
+    baton->callback = keep(env, args[2]);
+
+    for (size_t i = 0; i < spis.size(); i++) { spis[i]->Ref(); }
+    create_work(env, "spi.interleave", baton->job, interleave_work, interleave_after, baton);
+    schedule(env, baton->job, spis);
+    return js_undefined(env);
+  }
+
+  interleave(jobs);
+
+  napi_value results;
+  napi_value error = interleave_results(env, jobs, results);
+  if (type_of(env, error) != napi_null) {
+    napi_throw(env, error);
+    return NULL;
+  }
+  return results;
+}
+
+// Runs on the thread pool: no JS calls allowed in here.
+void Spi::interleave_work(napi_env env, void *data) {
+  InterleaveBaton *baton = static_cast<InterleaveBaton *>(data);
+  interleave(baton->jobs);
+}
+
+void Spi::interleave_after(napi_env env, napi_status status, void *data) {
+  InterleaveBaton *baton = static_cast<InterleaveBaton *>(data);
+
+  napi_value results;
+  napi_value argv[2];
+  argv[0] = interleave_results(env, baton->jobs, results);
+  argv[1] = results;
+
+  release(env, baton->buffers);
+  finish(env, baton->job, baton->devices);
+
+  call_back(env, baton->callback, 2, argv);
+
+  for (size_t i = 0; i < baton->devices.size(); i++) { baton->devices[i]->Unref(); }
+  delete baton;
+}
 
-  if (args.IsConstructCall()) {
-    Spi* spi = new Spi();
-    spi->Wrap(args.This());
-    args.GetReturnValue().Set(args.This());
+struct AutotuneBaton {
+  AsyncJob job;
+  Spi *self;
+  TuneOptions options;
+  TuneResult result;
+  const char *error;
+  napi_ref callback;
+};
+
+static napi_value tune_result(napi_env env, const TuneResult &result) {
+  napi_value tuned = js_object(env);
+  set_property(env, tuned, "maxSpeed", js_uint(env, result.max_speed));
+  set_property(env, tuned, "settle", js_uint(env, result.settle_ns));
+  set_property(env, tuned, "delay", js_uint(env, result.delay));
+  set_property(env, tuned, "rdyLag", js_number(env, result.rdy_lag_ns));
+  set_property(env, tuned, "rdyWait", js_number(env, result.rdy_wait_ns));
+  set_property(env, tuned, "bytesPerSec", js_number(env, result.bytes_per_sec));
+  set_property(env, tuned, "trials", js_uint(env, result.trials));
+  set_property(env, tuned, "verified", js_bool(env, result.verified));
+  return tuned;
+}
+
+// autotune(minSpeed, maxSpeed, bytes, trials, margin[, callback])
+//
+// Sweeps maxSpeed, delay and settle for the fastest settings the display
+// takes a test image with, see autotune.h, and applies them. Returns
+// {maxSpeed, settle, delay, rdyLag, rdyWait, bytesPerSec, trials, verified}, or
+// passes it to callback when the sweep runs on the thread pool.
+SPI_FUNC_IMPL(Autotune) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+  if (self->m_engine_running) {
+    EXCEPTION("Cannot tune while the transmit engine runs");
+    return NULL;
+  }
+
+  int min_speed, max_speed, bytes, trials, margin;
+  if (!self->get_argument_greater_than(env, args, 0, 0, min_speed)) { return NULL; }
+  if (!self->get_argument_greater_than(env, args, 1, 0, max_speed)) { return NULL; }
+  if (!self->get_argument_greater_than(env, args, 2, 0, bytes)) { return NULL; }
+  if (!self->get_argument_greater_than(env, args, 3, 0, trials)) { return NULL; }
+  if (!self->get_argument_greater_than(env, args, 4, -1, margin)) { return NULL; }
+
+  TuneOptions options = { (uint32_t)min_speed, (uint32_t)max_speed, (uint32_t)bytes,
+                          (uint32_t)trials, (uint32_t)margin };
+
+  if (type_of(env, args[5]) == napi_function) {
+    AutotuneBaton *baton = new AutotuneBaton();
+    baton->self = self;
+    baton->options = options;
+    baton->error = NULL;
+    baton->callback = keep(env, args[5]);
+
+    self->Ref();
+    create_work(env, "spi.autotune", baton->job, autotune_work, autotune_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  TuneResult result;
+  const char *error = autotune(*self, options, result);
+  if (error) {
+    EXCEPTION(error);
+    return NULL;
+  }
+
+  return tune_result(env, result);
+}
+
+void Spi::autotune_work(napi_env env, void *data) {
+  AutotuneBaton *baton = static_cast<AutotuneBaton *>(data);
+  baton->error = autotune(*baton->self, baton->options, baton->result);
+}
+
+void Spi::autotune_after(napi_env env, napi_status status, void *data) {
+  AutotuneBaton *baton = static_cast<AutotuneBaton *>(data);
+
+  napi_value argv[2];
+  if (baton->error) {
+    argv[0] = js_error(env, baton->error);
+    argv[1] = js_undefined(env);
   } else {
-    Local<Function> cons = Local<Function>::New(isolate, constructor);
-    args.GetReturnValue().Set(cons->NewInstance());
+    argv[0] = js_null(env);
+    argv[1] = tune_result(env, baton->result);
+  }
+
+  baton->self->finish(env, baton->job);
+
+  call_back(env, baton->callback, 2, argv);
+
+  baton->self->Unref();
+  delete baton;
+}
+
+// engineStart(depth[, priority[, cpu]])
+//
+// Starts a dedicated transmit thread that sends the frames handed to submit()
+// in order. depth is the number of frames that can be queued. A priority > 0
+// runs the thread as SCHED_FIFO at that priority (needs root or CAP_SYS_NICE),
+// and cpu >= 0 pins it to that core.
+SPI_FUNC_IMPL(EngineStart) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+
+  if (self->m_engine_running) {
+    EXCEPTION("Transmit engine already running");
+    return NULL;
+  }
+  // A queued commit or autotune would run alongside the engine
+  if (!self->m_jobs.empty()) {
+    EXCEPTION("Wait for pending async calls before starting the transmit engine");
+    return NULL;
+  }
+
+  int depth;
+  if (!self->get_argument_greater_than(env, args, 0, 0, depth)) { return NULL; }
+  int priority = 0;
+  if (args.Length() > 1 && !self->get_argument(env, args, 1, priority)) { return NULL; }
+  int cpu = -1;
+  if (args.Length() > 2 && !self->get_argument(env, args, 2, cpu)) { return NULL; }
+  int buffers = 2;
+  if (args.Length() > 3 && !self->get_argument(env, args, 3, buffers)) { return NULL; }
+  if (buffers < 2 || buffers > PRESENT_MAX_BUFFERS) {
+    EXCEPTION("Present buffers must be 2 or 3");
+    return NULL;
+  }
+
+  int ret = self->engine_start(depth, priority, cpu, buffers);
+  if (ret != 0) {
+    EXCEPTION(ret == EPERM ? "Not allowed to run the transmit thread as SCHED_FIFO"
+            : ret == EINVAL ? "Invalid transmit thread priority or cpu"
+            : "Unable to start transmit thread");
+    return NULL;
+  }
+  self->Ref();
+
+  FUNCTION_CHAIN;
+}
+
+// Sends whatever is still queued, then joins the transmit thread.
+SPI_FUNC_IMPL(EngineStop) {
+  FUNCTION_PREAMBLE;
+  if (self->m_engine_running) {
+    self->engine_stop();
+    self->Unref();
+  }
+  FUNCTION_CHAIN;
+}
+
+// submit(buffer) - queues a copy of buffer on the transmit engine. Returns
+// false without queuing anything if the queue is full or the copy cannot
+// be allocated.
+SPI_FUNC_IMPL(Submit) {
+  FUNCTION_PREAMBLE;
+  if (!self->m_engine_running) {
+    EXCEPTION("Transmit engine not running");
+    return NULL;
+  }
+  if (!self->require_arguments(env, args, 1)) { return NULL; }
+  if (!is_buffer(env, args[0])) {
+    EXCEPTION("Argument 0 must be a Buffer");
+    return NULL;
+  }
+
+  return js_bool(env, self->submit(buffer_data(env, args[0]), buffer_length(env, args[0])));
+}
+
+// present(frame)
+//
+// Hands a whole framebuffer frame to the transmit engine and returns right
+// away. The engine sends the changes of the newest frame only: a frame still
+// waiting when the next one comes in is dropped.
+SPI_FUNC_IMPL(Present) {
+  FUNCTION_PREAMBLE;
+  if (!self->m_engine_running) {
+    EXCEPTION("Transmit engine not running");
+    return NULL;
+  }
+  if (!self->m_framebuffer) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return NULL;
+  }
+  if (!self->require_arguments(env, args, 1)) { return NULL; }
+  if (!is_buffer(env, args[0])) {
+    EXCEPTION("Argument 0 must be a Buffer");
+    return NULL;
+  }
+
+  if (buffer_length(env, args[0]) != self->m_framebuffer->size()) {
+    EXCEPTION("Frame size does not match the framebuffer");
+    return NULL;
+  }
+
+  self->present((const uint8_t *)buffer_data(env, args[0]));
+  FUNCTION_CHAIN;
+}
+
+SPI_FUNC_IMPL(EngineStatus) {
+  FUNCTION_PREAMBLE;
+
+  napi_value status = js_object(env);
+  set_property(env, status, "running", js_bool(env, self->m_engine_running));
+  set_property(env, status, "capacity", js_number(env, self->m_ring ? self->m_ring->capacity() : 0));
+  set_property(env, status, "queued", js_number(env, self->m_ring ? self->m_ring->size() : 0));
+  set_property(env, status, "queuedBytes", js_number(env, self->m_engine_queued_bytes));
+  set_property(env, status, "sentFrames", js_number(env, self->m_engine_sent_frames));
+  set_property(env, status, "sentBytes", js_number(env, self->m_engine_sent_bytes));
+  set_property(env, status, "errors", js_number(env, self->m_engine_errors));
+  set_property(env, status, "presentFrames", js_number(env, self->m_present_frames));
+  set_property(env, status, "presented", js_number(env, self->m_present_presented));
+  set_property(env, status, "dropped", js_number(env, self->m_present_dropped));
+  set_property(env, status, "torn", js_number(env, self->m_present_torn));
+
+  return status;
+}
+
+// framebuffer(width, height)
+//
+// Sets up the shadow framebuffer used by commit(). The first commit sends
+// the whole frame.
+SPI_FUNC_IMPL(SetFramebuffer) {
+  FUNCTION_PREAMBLE;
+  if (!self->require_arguments(env, args, 2)) { return NULL; }
+
+  uint32_t width = uint32_value(env, args[0]);
+  uint32_t height = uint32_value(env, args[1]);
+  const char *error = self->set_framebuffer(width, height);
+  if (error) {
+    EXCEPTION(error);
+    return NULL;
+  }
+
+  FUNCTION_CHAIN;
+}
+
+// commit(frame[, callback])
+//
+// frame is a whole column major frame. Only the areas that differ from the
+// last committed frame are sent. Returns the number of bytes sent, or passes
+// it to callback when the transfer runs on the thread pool.
+SPI_FUNC_IMPL(Commit) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+  if (!self->m_framebuffer) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return NULL;
+  }
+  if (self->m_engine_running) {
+    EXCEPTION("Use present() while the transmit engine runs");
+    return NULL;
+  }
+  if (!self->require_arguments(env, args, 1)) { return NULL; }
+  if (!is_buffer(env, args[0])) {
+    EXCEPTION("Argument 0 must be a Buffer");
+    return NULL;
+  }
+
+  if (buffer_length(env, args[0]) != self->m_framebuffer->size()) {
+    EXCEPTION("Frame size does not match the framebuffer");
+    return NULL;
+  }
+  const uint8_t *frame = (const uint8_t *)buffer_data(env, args[0]);
+
+  if (type_of(env, args[1]) == napi_function) {
+    TransferBaton *baton = new TransferBaton();
+    baton->self = self;
+    // Encoded when its turn comes, against the shadow as it is then
+    baton->frame.assign(frame, frame + self->m_framebuffer->size());
+    baton->write = NULL;
+    baton->read = NULL;
+    baton->result = 0;
+    baton->callback = keep(env, args[1]);
+
+    self->Ref();
+    create_work(env, "spi.commit", baton->job, transfer_work, transfer_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  int ret = self->commit(frame);
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
+
+  return js_int(env, ret);
+}
+
+// invalidate()
+//
+// Forgets what the display shows, the next commit() sends the whole frame.
+// Use it after writing to the display some other way.
+SPI_FUNC_IMPL(Invalidate) {
+  FUNCTION_PREAMBLE;
+  self->invalidate();
+  FUNCTION_CHAIN;
+}
+
+// addLayer(width, height, z, blend)
+//
+// Adds a dark layer at (0, 0) to the compositor and returns its id. blend is
+// BLEND_OR, BLEND_AND or BLEND_XOR; higher z is drawn on top.
+SPI_FUNC_IMPL(AddLayer) {
+  FUNCTION_PREAMBLE;
+  if (!self->m_compositor) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return NULL;
+  }
+
+  int width, height, z, blend;
+  if (!self->get_argument_greater_than(env, args, 0, 0, width)) { return NULL; }
+  if (!self->get_argument_greater_than(env, args, 1, 0, height)) { return NULL; }
+  if (!self->get_argument(env, args, 2, z)) { return NULL; }
+  if (!self->get_argument(env, args, 3, blend)) { return NULL; }
+
+  int id = self->m_compositor->add(width, height, z, blend);
+  if (id < 0) {
+    EXCEPTION("Unknown blend mode");
+    return NULL;
+  }
+
+  return js_int(env, id);
+}
+
+// removeLayer(id)
+SPI_FUNC_IMPL(RemoveLayer) {
+  FUNCTION_PREAMBLE;
+  int id;
+  if (!self->get_layer(env, args, id)) { return NULL; }
+
+  self->m_compositor->remove(id);
+  FUNCTION_CHAIN;
+}
+
+// layerBitmap(id, data)
+//
+// Replaces the layer bitmap: column major, width * ceil(height / 8) bytes
+SPI_FUNC_IMPL(LayerBitmap) {
+  FUNCTION_PREAMBLE;
+  int id;
+  if (!self->get_layer(env, args, id)) { return NULL; }
+  if (args.Length() < 2 || !is_buffer(env, args[1])) {
+    EXCEPTION("Bitmap must be a Buffer");
+    return NULL;
+  }
+
+  if (!self->m_compositor->set_bitmap(id, (const uint8_t *)buffer_data(env, args[1]),
+                                      buffer_length(env, args[1]))) {
+    EXCEPTION("Bitmap size does not match the layer");
+    return NULL;
+  }
+
+  FUNCTION_CHAIN;
+}
+
+// moveLayer(id, x, y)
+//
+// Places the top left of the layer at pixel (x, y), anywhere, even partly
+// or wholly off the display
+SPI_FUNC_IMPL(MoveLayer) {
+  FUNCTION_PREAMBLE;
+  int id, x, y;
+  if (!self->get_layer(env, args, id)) { return NULL; }
+  if (!self->get_argument(env, args, 1, x)) { return NULL; }
+  if (!self->get_argument(env, args, 2, y)) { return NULL; }
+
+  self->m_compositor->move(id, x, y);
+  FUNCTION_CHAIN;
+}
+
+// layer(id, options)
+//
+// Changes any of z, blend, visible, scroll (bitmap column shown first, the
+// bitmap wraps around), width (on the display, a wider layer repeats its
+// bitmap) and clip ([x, y, width, height] on the display).
+SPI_FUNC_IMPL(Layer) {
+  FUNCTION_PREAMBLE;
+  int id;
+  if (!self->get_layer(env, args, id)) { return NULL; }
+  if (args.Length() < 2 || type_of(env, args[1]) != napi_object) {
+    EXCEPTION("Options must be an object");
+    return NULL;
+  }
+
+  Compositor *compositor = self->m_compositor;
+  napi_value options = args[1];
+  napi_value z = get_property(env, options, "z");
+  napi_value blend = get_property(env, options, "blend");
+  napi_value visible = get_property(env, options, "visible");
+  napi_value scroll = get_property(env, options, "scroll");
+  napi_value width = get_property(env, options, "width");
+  napi_value clip = get_property(env, options, "clip");
+
+  if (type_of(env, blend) != napi_undefined && !compositor->set_blend(id, int32_value(env, blend))) {
+    EXCEPTION("Unknown blend mode");
+    return NULL;
+  }
+  if (type_of(env, width) != napi_undefined && !compositor->set_width(id, uint32_value(env, width))) {
+    EXCEPTION("Layer width must be greater than 0");
+    return NULL;
+  }
+  if (type_of(env, clip) != napi_undefined) {
+    ClipRect rect = { 0, 0, (int)self->display_width(), (int)self->display_rows() * 8 };
+    if (is_array(env, clip)) {
+      if (array_length(env, clip) != 4) {
+        EXCEPTION("Clip must be [x, y, width, height]");
+        return NULL;
+      }
+      rect.x = int32_value(env, get_element(env, clip, 0));
+      rect.y = int32_value(env, get_element(env, clip, 1));
+      rect.width = int32_value(env, get_element(env, clip, 2));
+      rect.height = int32_value(env, get_element(env, clip, 3));
+    }
+    if (!compositor->set_clip(id, rect)) {
+      EXCEPTION("Clip width and height must not be negative");
+      return NULL;
+    }
+  }
+  if (type_of(env, scroll) != napi_undefined) { compositor->set_scroll(id, uint32_value(env, scroll)); }
+  if (type_of(env, visible) != napi_undefined) { compositor->set_visible(id, bool_value(env, visible)); }
+  if (type_of(env, z) != napi_undefined) { compositor->set_z(id, int32_value(env, z)); }
+
+  FUNCTION_CHAIN;
+}
+
+// compose([frame])
+//
+// Rebuilds the columns the layer changes touched. Returns the column ranges
+// changed since the last commitLayers(), as [x, width] pairs. With frame, a
+// Buffer the size of the framebuffer, also copies the composed frame into it,
+// for present() or drawing on top.
+SPI_FUNC_IMPL(Compose) {
+  FUNCTION_PREAMBLE;
+  if (!self->m_compositor) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return NULL;
+  }
+
+  if (args.Length() > 0) {
+    if (!is_buffer(env, args[0]) ||
+        buffer_length(env, args[0]) != self->m_compositor->size()) {
+      EXCEPTION("Frame size does not match the framebuffer");
+      return NULL;
+    }
+  }
+
+  self->compose_layers();
+  if (args.Length() > 0) {
+    memcpy(buffer_data(env, args[0]), self->m_compositor->frame(), self->m_compositor->size());
+  }
+
+  napi_value ranges = js_array(env);
+  uint32_t count = 0;
+  const std::vector<uint8_t> &changed = self->m_changed;
+  for (uint32_t x = 0; x < changed.size(); x++) {
+    if (!changed[x]) { continue; }
+    uint32_t end = x;
+    while (end < changed.size() && changed[end]) { end++; }
+
+    napi_value range = js_array(env, 2);
+    set_element(env, range, 0, js_uint(env, x));
+    set_element(env, range, 1, js_uint(env, end - x));
+    set_element(env, ranges, count++, range);
+    x = end;
+  }
+
+  return ranges;
+}
+
+// commitLayers([callback])
+//
+// Composes the layers and sends what changed, like commit(). Only the
+// columns the compositor reports as changed are diffed and sent.
+SPI_FUNC_IMPL(CommitLayers) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+  if (!self->m_compositor) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return NULL;
+  }
+  if (self->m_engine_running) {
+    EXCEPTION("Use compose(frame) and present() while the transmit engine runs");
+    return NULL;
+  }
+
+  if (type_of(env, args[0]) == napi_function) {
+    TransferBaton *baton = new TransferBaton();
+    baton->self = self;
+    // Composed now, diffed and sent when its turn comes
+    self->compose_layers();
+    const uint8_t *frame = self->m_compositor->frame();
+    baton->frame.assign(frame, frame + self->m_compositor->size());
+    baton->changed.swap(self->m_changed);
+    self->m_changed.assign(baton->changed.size(), 0);
+    baton->write = NULL;
+    baton->read = NULL;
+    baton->result = 0;
+    baton->callback = keep(env, args[0]);
+
+    self->Ref();
+    create_work(env, "spi.commitLayers", baton->job, transfer_work, transfer_after, baton);
+    self->schedule(env, baton->job);
+    return js_undefined(env);
+  }
+
+  int ret = self->commit_layers();
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
+
+  return js_int(env, ret);
+}
+
+// address(x, y)
+//
+// Display memory address of the byte holding pixel (x, y)
+SPI_FUNC_IMPL(Address) {
+  FUNCTION_PREAMBLE;
+  int x, y;
+  if (!self->get_argument(env, args, 0, x)) { return NULL; }
+  if (!self->get_argument(env, args, 1, y)) { return NULL; }
+  if (x < 0 || y < 0 || (uint32_t)x >= self->display_width() ||
+      (uint32_t)y >= self->display_rows() * 8) {
+    EXCEPTION("Pixel outside the display");
+    return NULL;
   }
+
+  return js_uint(env, ntk_address(self->display_rows(), x, y));
 }
 
-// TODO: Make Non-blocking once basic functionality is proven
-void Spi::Open(const FunctionCallbackInfo<Value>& args) {
+// encodeBitImage(address, data[, out[, offset]])
+//
+// Encodes a 3900 series Graphic DMA bit image write. Without out, returns a
+// new Buffer holding the command. With out, writes the command at offset and
+// returns its length.
+SPI_FUNC_IMPL(EncodeBitImage) {
   FUNCTION_PREAMBLE;
-  if (!self->require_arguments(isolate, args, 1)) { return; }
-  ASSERT_NOT_OPEN;
+  uint16_t address, size;
+  const uint8_t *data;
+  if (!self->get_bit_image(env, args, 0, address, data, size)) { return NULL; }
 
-  String::Utf8Value device(args[0]->ToString());
-  int retval = 0;
-
-  self->m_fd = open(*device, O_RDWR); // Blocking!
-  if (self->m_fd < 0) {
-    EXCEPTION("Unable to open device");
-    return;
-  }
-
-  SET_IOCTL_VALUE(self->m_fd, SPI_IOC_WR_MODE, self->m_mode);
-  SET_IOCTL_VALUE(self->m_fd, SPI_IOC_WR_BITS_PER_WORD, self->m_bits_per_word);
-  SET_IOCTL_VALUE(self->m_fd, SPI_IOC_WR_MAX_SPEED_HZ, self->m_max_speed);
-
-  // Setup the GPIO pin as well
-  int mem_fd;
-  /* open /dev/mem */
-   if ((mem_fd = open("/dev/mem", O_RDWR|O_SYNC) ) < 0) {
-      EXCEPTION("can't open /dev/mem");
-      return;
-   }
- 
-   /* mmap GPIO */
-   gpio_map = mmap(
-      NULL,             //Any adddress in our space will do
-      BLOCK_SIZE,       //Map length
-      PROT_READ|PROT_WRITE,// Enable reading & writting to mapped memory
-      MAP_SHARED,       //Shared with other processes
-      mem_fd,           //File to map
-      GPIO_BASE         //Offset to GPIO peripheral
-   );
- 
-   close(mem_fd); //No need to keep mem_fd open after mmap
- 
-   if (gpio_map == MAP_FAILED) {
-      EXCEPTION("mmap error");//errno also set!
-      
-   }
-
-   printf("Ready pin: %u", self->m_rdy_pin);
- 
-   // Always use volatile pointer!
-   gpio = (volatile unsigned *)gpio_map;
-
-   INP_GPIO(self->m_wr_pin);
-   OUT_GPIO(self->m_wr_pin);
-
-   INP_GPIO(self->m_rdy_pin);
-   // Enable pulldown on Ready pin:
-   GPIO_PULL = 1;
-   delayMicrosecondsHard(5);
-   GPIO_PULLCLK0 = 1 << self->m_rdy_pin;
-   delayMicrosecondsHard(5);
-   GPIO_PULL = 0;
-   GPIO_PULLCLK0 = 0;   
+  napi_value out;
+  size_t offset;
+  if (!self->get_output(env, args, 2, NTK_BIT_IMAGE_HEADER + size, out, offset)) { return NULL; }
 
-  FUNCTION_CHAIN;
+  size_t length = ntk_bit_image((uint8_t *)buffer_data(env, out) + offset, address, data, size);
+  if (args.Length() > 2) {
+    return js_uint(env, length);
+  }
+  return out;
 }
 
-void Spi::Close(const FunctionCallbackInfo<Value> &args) {
+// encodeWindow(x, y, width, height, data[, out[, offset]])
+//
+// Encodes a write of data, width x height pixels in column major order, at
+// (x, y). y and height must be multiples of 8. 3900 series displays get bit
+// image writes, B-series ones a cursor set and a real-time bit image. Returns
+// like encodeBitImage().
+SPI_FUNC_IMPL(EncodeWindow) {
   FUNCTION_PREAMBLE;
-  ONLY_IF_OPEN;
+  uint32_t x, row, width, rows;
+  const uint8_t *data;
+  if (!self->get_window(env, args, 0, x, row, width, rows, data)) { return NULL; }
+
+  bool bseries = self->bseries_commands();
+  size_t size = ntk_window_size(bseries, self->display_rows(), width, rows);
+  napi_value out;
+  size_t offset;
+  if (!self->get_output(env, args, 5, size, out, offset)) { return NULL; }
+
+  size_t length = ntk_window((uint8_t *)buffer_data(env, out) + offset, bseries,
+                             self->display_rows(), x, row, width, rows, data);
+  if (args.Length() > 5) {
+    return js_uint(env, length);
+  }
+  return out;
+}
 
-  close(self->m_fd);
-  self->m_fd = -1;
+// writeBitImage(address, data)
+//
+// Same as encodeBitImage(), sent right away. Returns the bytes sent.
+SPI_FUNC_IMPL(WriteBitImage) {
+  FUNCTION_PREAMBLE;
+  ASSERT_OPEN;
+  uint16_t address, size;
+  const uint8_t *data;
+  if (!self->get_bit_image(env, args, 0, address, data, size)) { return NULL; }
+
+  int ret = self->write_bit_image(address, data, size);
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
 
-  FUNCTION_CHAIN;
+  return js_int(env, ret);
 }
 
-// tranfer(write_buffer, read_buffer);
-void Spi::Transfer(const FunctionCallbackInfo<Value> &args) {
+// writeWindow(x, y, width, height, data)
+//
+// Same as encodeWindow(), sent right away. Returns the bytes sent.
+SPI_FUNC_IMPL(WriteWindow) {
   FUNCTION_PREAMBLE;
   ASSERT_OPEN;
-    if (!self->require_arguments(isolate, args, 2)) { return; }
+  uint32_t x, row, width, rows;
+  const uint8_t *data;
+  if (!self->get_window(env, args, 0, x, row, width, rows, data)) { return NULL; }
+
+  int ret = self->write_window(x, row, width, rows, data);
+  if (ret < 0) {
+    EXCEPTION(SpiDevice::transfer_error(ret));
+    return NULL;
+  }
 
-  if ((args[0]->IsNull()) && (args[1]->IsNull())) {
-    EXCEPTION("Both buffers cannot be null");
-    return;
+  return js_int(env, ret);
+}
+
+// pack(src, width, height, format, stride, threshold[, frame, x, y])
+//
+// Packs a gray (format 1) or RGBA (format 4) canvas, stride bytes per row,
+// to column major 1bpp. A pixel is lit when its gray level is >= threshold.
+// Without frame, returns a new Buffer of width * height / 8 bytes, ready for
+// encodeWindow(). With frame, a whole display frame as used by commit(), the
+// pixels land at (x, y) in it and frame is returned.
+SPI_FUNC_IMPL(Pack) {
+  FUNCTION_PREAMBLE;
+  const uint8_t *src;
+  uint32_t width, height;
+  int format, threshold;
+  size_t stride;
+  if (!self->get_canvas(env, args, 0, src, width, height, format, stride)) { return NULL; }
+  if (!self->get_argument(env, args, 5, threshold)) { return NULL; }
+  if (threshold < 0 || threshold > 255) {
+    EXCEPTION("Threshold must be between 0 and 255");
+    return NULL;
   }
 
-  char *write_buffer = NULL;
-  char *read_buffer = NULL;
-  size_t write_length = -1;
-  size_t read_length = -1;
-  Local<Object> write_buffer_obj;
-  Local<Object> read_buffer_obj;
+  napi_value out;
+  uint8_t *dest;
+  uint32_t out_rows;
+  if (!self->get_frame_target(env, args, 6, width, height, out, dest, out_rows)) { return NULL; }
 
-  if (Buffer::HasInstance(args[0])) {
-    write_buffer_obj = args[0]->ToObject();
-    write_buffer = Buffer::Data(write_buffer_obj);
-    write_length = Buffer::Length(write_buffer_obj);
+  pack_threshold(dest, out_rows, src, stride, format, width, height, threshold);
+
+  return out;
+}
+
+// dither(src, width, height, format, stride, method[, frame, x, y])
+//
+// Same as pack(), with ordered (0) or Floyd-Steinberg (1) dithering instead
+// of a threshold.
+SPI_FUNC_IMPL(Dither) {
+  FUNCTION_PREAMBLE;
+  const uint8_t *src;
+  uint32_t width, height;
+  int format, method;
+  size_t stride;
+  if (!self->get_canvas(env, args, 0, src, width, height, format, stride)) { return NULL; }
+  if (!self->get_argument(env, args, 5, method)) { return NULL; }
+  if (method != DITHER_BAYER && method != DITHER_FLOYD_STEINBERG) {
+    EXCEPTION("Unknown dithering method");
+    return NULL;
   }
 
-  if (Buffer::HasInstance(args[1])) {
-    read_buffer_obj = args[1]->ToObject();
-    read_buffer = Buffer::Data(read_buffer_obj);
-    read_length = Buffer::Length(read_buffer_obj);
+  napi_value out;
+  uint8_t *dest;
+  uint32_t out_rows;
+  if (!self->get_frame_target(env, args, 6, width, height, out, dest, out_rows)) { return NULL; }
+
+  if (method == DITHER_BAYER) {
+    uint32_t x = (args.Length() > 7) ? uint32_value(env, args[7]) : 0;
+    dither_bayer(dest, out_rows, src, stride, format, width, height, x);
+  } else {
+    dither_floyd_steinberg(dest, out_rows, src, stride, format, width, height);
   }
 
-  if (write_length > 0 && read_length > 0 && write_length != read_length) {
-    EXCEPTION("Read and write buffers MUST be the same length");
-    return;
+  return out;
+}
+
+// Fonts by id, shared by all devices of an environment. Id 0 is the built-in
+// font, loaded fonts live as long as the environment.
+static Font *get_font(napi_env env, napi_value value) {
+  std::vector<Font *> &fonts = addon_data(env)->fonts;
+
+  if (type_of(env, value) == napi_undefined) { return fonts[0]; }
+  if (type_of(env, value) != napi_number || uint32_value(env, value) >= fonts.size()) {
+    EXCEPTION("Unknown font");
+    return NULL;
   }
+  return fonts[uint32_value(env, value)];
+}
+
+// loadFont(buffer)
+//
+// Parses a BDF font and keeps it rasterized. Returns
+// {id, height, ascent, glyphs}, id being what text() takes.
+SPI_FUNC_IMPL(LoadFont) {
+  CallArgs args(env, info);
 
-  self->full_duplex_transfer(isolate, args, write_buffer, read_buffer,
-                                MAX(write_length, read_length),
-                                self->m_max_speed, self->m_delay, self->m_bits_per_word);
+  if (args.Length() < 1 || !is_buffer(env, args[0])) {
+    EXCEPTION("Font must be a Buffer");
+    return NULL;
+  }
+  std::vector<Font *> &fonts = addon_data(env)->fonts;
 
+  const char *error;
+  Font *font = Font::load_bdf(buffer_data(env, args[0]), buffer_length(env, args[0]), &error);
+  if (!font) {
+    EXCEPTION(error);
+    return NULL;
+  }
+  fonts.push_back(font);
+
+  napi_value result = js_object(env);
+  set_property(env, result, "id", js_number(env, fonts.size() - 1));
+  set_property(env, result, "height", js_number(env, font->height()));
+  set_property(env, result, "ascent", js_number(env, font->ascent()));
+  set_property(env, result, "glyphs", js_number(env, font->glyphs()));
+  return result;
 }
 
-void Spi::full_duplex_transfer(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value> &args,
-  char *write,
-  char *read,
-  size_t length,
-  uint32_t speed,
-  uint16_t delay,
-  uint8_t bits
-) {
-  Spi* self = ObjectWrap::Unwrap<Spi>(args.This());
-  struct spi_ioc_transfer data = {
-	  (unsigned long)write,
-	  (unsigned long)read,
-	  1,
-	  speed,
-	  delay,
-	  bits,
-    0,   // cs_change
-    0,  // tx_nbits
-    0,  // rx_nbits
-    0   // pad
-  };
+// textWidth(font, string)
+//
+// Width in pixels of string drawn with font
+SPI_FUNC_IMPL(TextWidth) {
+  CallArgs args(env, info);
 
-  int ret =0;
+  Font *font = get_font(env, args[0]);
+  if (!font) { return NULL; }
 
-  GPIO_SET = 1 << self->m_wr_pin;
+  return js_uint(env, font->text_width(utf8_value(env, args[1])));
+}
 
-  if (self->m_invert_rdy) {
-    while(GET_GPIO(self->m_rdy_pin)){};
-  } else {
-    while(!GET_GPIO(self->m_rdy_pin)){};
-  }  
+// text(string, font, mode[, frame, x, y])
+//
+// Draws string with font; mode is TEXT_OR, TEXT_REPLACE or TEXT_INVERT.
+// Without frame, returns a new Buffer holding the string in column major
+// order, textWidth() wide and the font height rounded up to 8 high, ready
+// for encodeWindow(). With frame, a whole display frame as used by commit(),
+// the string is drawn with the top left of its cell at (x, y), clipped to the
+// display, and frame is returned. y need not be a multiple of 8.
+SPI_FUNC_IMPL(Text) {
+  FUNCTION_PREAMBLE;
+  if (!self->require_arguments(env, args, 3)) { return NULL; }
 
-  // Now send byte by byte for the whole buffer
-  while (length--) {
-    ret = ioctl(this->m_fd, SPI_IOC_MESSAGE(1), &data);
+  std::string text = utf8_value(env, args[0]);
+  Font *font = get_font(env, args[1]);
+  if (!font) { return NULL; }
 
-    if (self->m_wr_pin) {
-      GPIO_CLR = 1 << self->m_wr_pin;
-      GPIO_SET = 1 << self->m_wr_pin;
-    }
+  int mode;
+  if (!self->get_argument(env, args, 2, mode)) { return NULL; }
+  if (mode != TEXT_OR && mode != TEXT_REPLACE && mode != TEXT_INVERT) {
+    EXCEPTION("Unknown text mode");
+    return NULL;
+  }
 
-    if (self->m_invert_rdy) {
-      //For Series 7000 displays, the busy pin (spec says 20us max!)
-      // can take a while to go up, so we have to add this delay. 10us
-      // works well in practice.
-      delayMicrosecondsHard(10); 
-      while(GET_GPIO(self->m_rdy_pin)){};
-    } else {
-      // The RDY line can take up to 500ns to do down,
-      // so we need to wait before reading it:
-      delayMicrosecondsHard(1); 
-      while(!GET_GPIO(self->m_rdy_pin)){};
-    }
-    //delayMicrosecondsHard(15);
-    
-    data.tx_buf++;
-   }
+  if (args.Length() <= 3) {
+    uint32_t width = font->text_width(text);
+    uint32_t rows = (font->height() + 7) / 8;
+    napi_value out = new_buffer(env, width * rows);
+    memset(buffer_data(env, out), 0, width * rows);
+    font->draw((uint8_t *)buffer_data(env, out), width, rows, 0, 0, text, mode);
+    return out;
+  }
 
-  if (ret == -1) {
-    EXCEPTION("Unable to send SPI message");
-    return;
+  if (!is_buffer(env, args[3])) {
+    EXCEPTION("Frame must be a Buffer");
+    return NULL;
+  }
+  napi_value frame = args[3];
+  if (buffer_length(env, frame) != self->display_width() * self->display_rows()) {
+    EXCEPTION("Frame size does not match the display");
+    return NULL;
   }
 
-  args.GetReturnValue().Set(ret);
+  int x = 0, y = 0;
+  if (args.Length() > 4 && !self->get_argument(env, args, 4, x)) { return NULL; }
+  if (args.Length() > 5 && !self->get_argument(env, args, 5, y)) { return NULL; }
+
+  font->draw((uint8_t *)buffer_data(env, frame), self->display_width(), self->display_rows(),
+             x, y, text, mode);
+  return frame;
 }
 
 // This overrides any of the OTHER set functions since modes are predefined
@@ -314,9 +1667,10 @@ void Spi::full_duplex_transfer(
 SPI_FUNC_IMPL(GetSetMode) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, self->m_mode)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, self->m_mode, result)) { return result; }
   int in_mode;
-  if (!self->get_argument(isolate, args, 0, in_mode)) { return; }
+  if (!self->get_argument(env, args, 0, in_mode)) { return NULL; }
 
   ASSERT_NOT_OPEN;
 
@@ -325,7 +1679,7 @@ SPI_FUNC_IMPL(GetSetMode) {
     self->m_mode = in_mode;
   } else {
     EXCEPTION("Argument 1 must be one of the SPI_MODE_X constants");
-    return;
+    return NULL;
   }
 
   FUNCTION_CHAIN;
@@ -333,9 +1687,10 @@ SPI_FUNC_IMPL(GetSetMode) {
 SPI_FUNC_IMPL(GetSetChipSelect) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, self->m_mode&(SPI_CS_HIGH|SPI_NO_CS))) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)(self->m_mode&(SPI_CS_HIGH|SPI_NO_CS)), result)) { return result; }
   int in_value;
-  if (!self->get_argument(isolate, args, 0, in_value)) { return; }
+  if (!self->get_argument(env, args, 0, in_value)) { return NULL; }
 
   ASSERT_NOT_OPEN;
 
@@ -358,10 +1713,11 @@ SPI_FUNC_IMPL(GetSetChipSelect) {
 
 SPI_FUNC_IMPL(GetSetBitsPerWord) {
   FUNCTION_PREAMBLE;
-  if (self->get_if_no_args(isolate, args, 0, (unsigned int)self->m_bits_per_word)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_bits_per_word, result)) { return result; }
 
   int in_value;
-  if (!self->get_argument_greater_than(isolate, args, 0, 0, in_value)) { return; }
+  if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
   ASSERT_NOT_OPEN;
 
   // TODO: Bounds checking?  Need to look up what the max value is
@@ -373,10 +1729,11 @@ SPI_FUNC_IMPL(GetSetBitsPerWord) {
 SPI_FUNC_IMPL(GetSetMaxSpeed) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, self->m_max_speed)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, self->m_max_speed, result)) { return result; }
 
   int in_value;
-  if (!self->get_argument_greater_than(isolate, args, 0, 0, in_value)) { return; }
+  if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
   ASSERT_NOT_OPEN;
 
   // TODO: Bounds Checking? Need to look up what the max value is
@@ -388,10 +1745,11 @@ SPI_FUNC_IMPL(GetSetMaxSpeed) {
 SPI_FUNC_IMPL(GetSetWrPin) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, (unsigned int)self->m_wr_pin)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_wr_pin, result)) { return result; }
 
   int in_value;
-  if (!self->get_argument_greater_than(isolate, args, 0, 0, in_value)) { return; }
+  if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
   ASSERT_NOT_OPEN;
 
   // TODO: Bounds Checking? Need to look up what the max value is
@@ -403,10 +1761,11 @@ SPI_FUNC_IMPL(GetSetWrPin) {
 SPI_FUNC_IMPL(GetSetRdyPin) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, (unsigned int)self->m_rdy_pin)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_rdy_pin, result)) { return result; }
 
   int in_value;
-  if (!self->get_argument_greater_than(isolate, args, 0, 0, in_value)) { return; }
+  if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
   ASSERT_NOT_OPEN;
 
   // TODO: Bounds Checking? Need to look up what the max value is
@@ -415,13 +1774,31 @@ SPI_FUNC_IMPL(GetSetRdyPin) {
   FUNCTION_CHAIN;
 }
 
+// Use the chip select edge as the !WR strobe instead of wrPin. This needs
+// CS wired to both the 74HC595 latch and the display !WR input.
+SPI_FUNC_IMPL(GetSetCsStrobe) {
+  FUNCTION_PREAMBLE;
+
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, self->m_cs_strobe, result)) { return result; }
+
+  bool in_value;
+  if (!self->get_argument(env, args, 0, in_value)) { return NULL; }
+  ASSERT_NOT_OPEN;
+
+  self->m_cs_strobe = in_value;
+
+  FUNCTION_CHAIN;
+}
+
 SPI_FUNC_IMPL(GetSetInvertRdy) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, self->m_invert_rdy)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, self->m_invert_rdy, result)) { return result; }
 
   bool in_value;
-  if (!self->get_argument(isolate, args, 0, in_value)) { return; }
+  if (!self->get_argument(env, args, 0, in_value)) { return NULL; }
 
   self->m_invert_rdy = in_value;
 
@@ -432,10 +1809,11 @@ SPI_FUNC_IMPL(GetSetInvertRdy) {
 SPI_FUNC_IMPL(GetSetbSeries) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, self->m_bseries)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, self->m_bseries, result)) { return result; }
 
   bool in_value;
-  if (!self->get_argument(isolate, args, 0, in_value)) { return; }
+  if (!self->get_argument(env, args, 0, in_value)) { return NULL; }
 
   self->m_bseries = in_value;
 
@@ -443,14 +1821,331 @@ SPI_FUNC_IMPL(GetSetbSeries) {
 }
 
 
+// Number of bytes sent back to back before waiting for RDY again. 1 (the
+// default) does the full handshake on every byte. Must not be larger than
+// what the display input buffer can hold.
+SPI_FUNC_IMPL(GetSetBurst) {
+  FUNCTION_PREAMBLE;
+
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_burst, result)) { return result; }
+
+  int in_value;
+  if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
+
+  if (in_value > MAX_BURST) {
+    EXCEPTION("Burst size is too large");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&self->m_lock);
+  self->m_burst = in_value;
+  pthread_mutex_unlock(&self->m_lock);
+
+  FUNCTION_CHAIN;
+}
+
+// Wait in ns between the !WR strobe and the first RDY/BUSY read. 0 goes back
+// to the series default: 1000 for the 3900, 10000 with invertRdy.
+SPI_FUNC_IMPL(GetSetSettle) {
+  FUNCTION_PREAMBLE;
+
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->settle_ns(), result)) { return result; }
+
+  int in_value;
+  if (!self->get_argument_greater_than(env, args, 0, -1, in_value)) { return NULL; }
+
+  pthread_mutex_lock(&self->m_lock);
+  self->m_settle_ns = in_value;
+  pthread_mutex_unlock(&self->m_lock);
+
+  FUNCTION_CHAIN;
+}
+
+// Time in ns RDY/BUSY is polled before the wait sleeps on an edge event of
+// the line. 0 goes back to the series default: 20000 for the 3900, 50000
+// with invertRdy.
+SPI_FUNC_IMPL(GetSetRdySpin) {
+  FUNCTION_PREAMBLE;
+
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->rdy_spin_ns(), result)) { return result; }
+
+  int in_value;
+  if (!self->get_argument_greater_than(env, args, 0, -1, in_value)) { return NULL; }
+
+  pthread_mutex_lock(&self->m_lock);
+  self->m_rdy_spin_ns = in_value;
+  pthread_mutex_unlock(&self->m_lock);
+
+  FUNCTION_CHAIN;
+}
+
+// Time in ms a transfer waits for the display before it fails with an RDY
+// timeout. 0 waits forever.
+SPI_FUNC_IMPL(GetSetRdyTimeout) {
+  FUNCTION_PREAMBLE;
+
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_rdy_timeout_ms, result)) { return result; }
+
+  int in_value;
+  if (!self->get_argument_greater_than(env, args, 0, -1, in_value)) { return NULL; }
+
+  pthread_mutex_lock(&self->m_lock);
+  self->m_rdy_timeout_ms = in_value;
+  pthread_mutex_unlock(&self->m_lock);
+
+  FUNCTION_CHAIN;
+}
+
+// timing() - what the delays really cost on this box: clock resolution and
+// read overhead, the calibrated loop speed, and the mean and worst duration
+// of 100 settle delays.
+SPI_FUNC_IMPL(Timing) {
+  FUNCTION_PREAMBLE;
+
+  const DelayTiming &timing = delay_timing();
+  uint32_t settle = self->settle_ns();
+  uint64_t total = 0, worst = 0;
+
+  for (int i = 0; i < 100; i++) {
+    uint64_t start = delay_now_ns();
+    delay_ns(settle);
+    uint64_t elapsed = delay_now_ns() - start;
+    total += elapsed;
+    if (elapsed > worst) { worst = elapsed; }
+  }
+
+  napi_value result = js_object(env);
+  set_property(env, result, "clockResolution", js_number(env, timing.resolution_ns));
+  set_property(env, result, "clockOverhead", js_number(env, timing.clock_overhead_ns));
+  set_property(env, result, "loopsPerUs", js_number(env, timing.loops_per_us));
+  set_property(env, result, "settle", js_number(env, settle));
+  set_property(env, result, "settleMean", js_number(env, total / 100));
+  set_property(env, result, "settleMax", js_number(env, worst));
+
+  return result;
+}
+
+// { count, sum, max, buckets }, buckets[i] counting values below 2^i and at
+// least 2^(i-1), up to the last non empty one
+static napi_value histogram_object(napi_env env, const StatHistogram &histogram) {
+  int used = STATS_BUCKETS;
+  while (used > 0 && !histogram.bucket(used - 1)) { used--; }
+
+  napi_value buckets = js_array(env, used);
+  for (int i = 0; i < used; i++) {
+    set_element(env, buckets, i, js_number(env, histogram.bucket(i)));
+  }
+
+  napi_value result = js_object(env);
+  set_property(env, result, "count", js_number(env, histogram.count()));
+  set_property(env, result, "sum", js_number(env, histogram.sum()));
+  set_property(env, result, "max", js_number(env, histogram.max()));
+  set_property(env, result, "buckets", buckets);
+  return result;
+}
+
+// Counters and histograms since the device was created or resetStats().
+// Times are in nanoseconds.
+SPI_FUNC_IMPL(Stats) {
+  FUNCTION_PREAMBLE;
+  const TransferStats &stats = self->m_stats;
+
+  napi_value result = js_object(env);
+  set_property(env, result, "transfers", js_number(env, stats.transfers.get()));
+  set_property(env, result, "bytes", js_number(env, stats.bytes.get()));
+  set_property(env, result, "errors", js_number(env, stats.errors.get()));
+  set_property(env, result, "ioctls", js_number(env, stats.ioctls.get()));
+  set_property(env, result, "strobes", js_number(env, stats.strobes.get()));
+  set_property(env, result, "strobeTime", js_number(env, stats.strobe_ns.get()));
+  set_property(env, result, "settles", js_number(env, stats.settles.get()));
+  set_property(env, result, "settleTime", js_number(env, stats.settle_ns.get()));
+  set_property(env, result, "longestStall", js_number(env, stats.rdy_wait_ns.max()));
+  set_property(env, result, "rdyBlocks", js_number(env, stats.rdy_blocks.get()));
+  set_property(env, result, "rdyTimeouts", js_number(env, stats.rdy_timeouts.get()));
+  set_property(env, result, "commandsQueued", js_number(env, stats.commands_queued.get()));
+  set_property(env, result, "commandsDropped", js_number(env, stats.commands_dropped.get()));
+  set_property(env, result, "ioctlTime", histogram_object(env, stats.ioctl_ns));
+  set_property(env, result, "rdyWait", histogram_object(env, stats.rdy_wait_ns));
+  set_property(env, result, "transferTime", histogram_object(env, stats.transfer_ns));
+  set_property(env, result, "throughput", histogram_object(env, stats.bytes_per_sec));
+
+  return result;
+}
+
+SPI_FUNC_IMPL(ResetStats) {
+  FUNCTION_PREAMBLE;
+  self->reset_stats();
+  FUNCTION_CHAIN;
+}
+
+// trace(capacity)
+//
+// Records every transfer, ioctl, !WR pulse, settle delay and RDY wait into
+// a ring of capacity events, the oldest being overwritten. 0 turns tracing
+// off. Calling it again starts over with an empty ring.
+SPI_FUNC_IMPL(Trace) {
+  FUNCTION_PREAMBLE;
+  int capacity;
+  if (!self->get_argument(env, args, 0, capacity)) { return NULL; }
+  if (capacity < 0) {
+    EXCEPTION("Trace capacity must not be negative");
+    return NULL;
+  }
+
+  self->set_trace(capacity);
+  FUNCTION_CHAIN;
+}
+
+// The trace as a Chrome trace / Perfetto JSON string, or null if tracing is
+// off
+SPI_FUNC_IMPL(TraceJson) {
+  FUNCTION_PREAMBLE;
+  std::string json;
+  if (!self->trace_json(getpid(), json)) {
+    return js_null(env);
+  }
+
+  return js_string(env, json.c_str(), json.size());
+}
+
+// "spidev" (default), "spi0", "parallel" or "sim"
+SPI_FUNC_IMPL(GetSetTransport) {
+  FUNCTION_PREAMBLE;
+
+  if (args.Length() == 0) {
+    return js_string(env, self->m_transport->name());
+  }
+
+  if (type_of(env, args[0]) != napi_string) {
+    EXCEPTION("Argument 0 must be a string");
+    return NULL;
+  }
+  ASSERT_NOT_OPEN;
+
+  std::string name = utf8_value(env, args[0]);
+  const char *error = self->set_transport(name.c_str());
+  if (error) {
+    EXCEPTION(error);
+    return NULL;
+  }
+
+  FUNCTION_CHAIN;
+}
+
+// dataPins([d0, ..., d7]) - the GPIOs wired to the display data lines, for
+// the parallel transport
+SPI_FUNC_IMPL(GetSetDataPins) {
+  FUNCTION_PREAMBLE;
+
+  if (args.Length() == 0) {
+    napi_value pins = js_array(env, 8);
+    for (int i = 0; i < 8; i++) {
+      set_element(env, pins, i, js_uint(env, self->m_data_pins[i]));
+    }
+    return pins;
+  }
+
+  if (!is_array(env, args[0]) || array_length(env, args[0]) != 8) {
+    EXCEPTION("Argument 0 must be an array of 8 pins, D0 first");
+    return NULL;
+  }
+  ASSERT_NOT_OPEN;
+
+  uint32_t data_pins[8];
+  for (int i = 0; i < 8; i++) {
+    napi_value pin = get_element(env, args[0], i);
+    if (!is_uint32(env, pin) || uint32_value(env, pin) > 31) {
+      EXCEPTION("Data pins must be GPIO numbers below 32");
+      return NULL;
+    }
+    data_pins[i] = uint32_value(env, pin);
+  }
+  memcpy(self->m_data_pins, data_pins, sizeof(data_pins));
+
+  FUNCTION_CHAIN;
+}
+
+static void set_sim_option(napi_env env, napi_value options, const char *name, uint32_t &value) {
+  napi_value option = get_property(env, options, name);
+  if (type_of(env, option) == napi_number) {
+    value = uint32_value(env, option);
+  }
+}
+
+// simulator([options]) - with options, changes the timing model of the
+// simulated display: width, height, busyDelay and busyTime (ns), fifo
+// and hangAfter (bytes), maxClock (Hz), spi0. Returns the model and what the
+// display received so far, including a copy of the decoded framebuffer.
+SPI_FUNC_IMPL(Simulator) {
+  FUNCTION_PREAMBLE;
+
+  if (!self->m_sim) {
+    EXCEPTION("Not using the sim transport");
+    return NULL;
+  }
+
+  SimConfig config;
+  if (type_of(env, args[0]) == napi_object) {
+    napi_value options = args[0];
+    config = self->m_sim->requested();
+    set_sim_option(env, options, "width", config.width);
+    set_sim_option(env, options, "height", config.height);
+    set_sim_option(env, options, "busyDelay", config.busy_delay_ns);
+    set_sim_option(env, options, "busyTime", config.busy_time_ns);
+    set_sim_option(env, options, "fifo", config.fifo);
+    set_sim_option(env, options, "hangAfter", config.hang_after);
+    set_sim_option(env, options, "maxClock", config.max_clock);
+    napi_value spi0 = get_property(env, options, "spi0");
+    if (type_of(env, spi0) != napi_undefined) { config.spi0 = bool_value(env, spi0); }
+
+    if (config.height % 8) {
+      EXCEPTION("Height must be a multiple of 8");
+      return NULL;
+    }
+
+    pthread_mutex_lock(&self->m_lock);
+    self->m_sim->configure(config);
+    pthread_mutex_unlock(&self->m_lock);
+  }
+
+  pthread_mutex_lock(&self->m_lock);
+  config = self->m_sim->config();
+  uint64_t bytes = self->m_sim->bytes();
+  uint64_t overruns = self->m_sim->overruns();
+  std::vector<uint8_t> framebuffer = self->m_sim->framebuffer();
+  pthread_mutex_unlock(&self->m_lock);
+
+  napi_value copy;
+  napi_create_buffer_copy(env, framebuffer.size(), framebuffer.data(), NULL, &copy);
+
+  napi_value state = js_object(env);
+  set_property(env, state, "width", js_uint(env, config.width));
+  set_property(env, state, "height", js_uint(env, config.height));
+  set_property(env, state, "busyDelay", js_uint(env, config.busy_delay_ns));
+  set_property(env, state, "busyTime", js_uint(env, config.busy_time_ns));
+  set_property(env, state, "fifo", js_uint(env, config.fifo));
+  set_property(env, state, "hangAfter", js_uint(env, config.hang_after));
+  set_property(env, state, "maxClock", js_uint(env, config.max_clock));
+  set_property(env, state, "spi0", js_bool(env, config.spi0 != 0));
+  set_property(env, state, "bytes", js_number(env, bytes));
+  set_property(env, state, "overruns", js_number(env, overruns));
+  set_property(env, state, "framebuffer", copy);
+
+  return state;
+}
 
 SPI_FUNC_IMPL(GetSet3Wire) {
   FUNCTION_PREAMBLE;
 
-  if (self->get_if_no_args(isolate, args, 0, (self->m_mode&SPI_3WIRE) > 0)) { return; }
+  napi_value result;
+  if (self->get_if_no_args(env, args, 0, (self->m_mode&SPI_3WIRE) > 0, result)) { return result; }
 
   bool in_value;
-  if (!self->get_argument(isolate, args, 0, in_value)) { return; }
+  if (!self->get_argument(env, args, 0, in_value)) { return NULL; }
 
   if (in_value) {
     self->m_mode |= SPI_3WIRE;
@@ -464,10 +2159,11 @@ SPI_FUNC_IMPL(GetSet3Wire) {
 SPI_FUNC_IMPL(GetSetDelay) {
 	FUNCTION_PREAMBLE;
 
-	if (self->get_if_no_args(isolate, args, 0, (unsigned int)self->m_delay)) { return; }
+	napi_value result;
+	if (self->get_if_no_args(env, args, 0, (unsigned int)self->m_delay, result)) { return result; }
 
   int in_value;
-	if (!self->get_argument_greater_than(isolate, args, 0, 0, in_value)) { return; }
+	if (!self->get_argument_greater_than(env, args, 0, 0, in_value)) { return NULL; }
 	ASSERT_NOT_OPEN;
 
 	self->m_delay = in_value;
@@ -489,11 +2185,11 @@ Internal Functions */
 
 bool
 Spi::require_arguments(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int count
 ) {
-    if (args.Length() < count) {
+    if (args.Length() < (size_t)count) {
       EXCEPTION(ERROR_EXPECTED_ARGUMENTS(count));
       return false;
     }
@@ -503,45 +2199,46 @@ Spi::require_arguments(
 
 bool
 Spi::get_argument(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int offset,
   int& value
 ) {
-  if (args.Length() <= offset || !args[offset]->IsInt32()) {
+  if (args.Length() <= (size_t)offset || !is_int32(env, args[offset])) {
     EXCEPTION(ERROR_ARGUMENT_NOT_INTEGER(offset));
     return false;
   }
 
-  value = args[offset]->Int32Value();
+  value = int32_value(env, args[offset]);
   return true;
 }
 
 bool
 Spi::get_argument(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int offset,
   bool& value
 ) {
-  if (args.Length() <= offset || !args[offset]->IsBoolean()) {
+  if (args.Length() <= (size_t)offset || type_of(env, args[offset]) != napi_boolean) {
     EXCEPTION(ERROR_ARGUMENT_NOT_BOOLEAN(offset));
     return false;
   }
 
-  value = args[offset]->BooleanValue();
+  value = bool_value(env, args[offset]);
   return true;
 }
 
 bool
 Spi::get_if_no_args(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int offset,
-  unsigned int value
+  unsigned int value,
+  napi_value& result
 ) {
-  if (args.Length() <= offset) {
-    args.GetReturnValue().Set(value);
+  if (args.Length() <= (size_t)offset) {
+    result = js_uint(env, value);
     return true;
   }
 
@@ -550,13 +2247,14 @@ Spi::get_if_no_args(
 
 bool
 Spi::get_if_no_args(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int offset,
-  bool value
+  bool value,
+  napi_value& result
 ) {
-  if (args.Length() <= offset) {
-    args.GetReturnValue().Set(value);
+  if (args.Length() <= (size_t)offset) {
+    result = js_bool(env, value);
     return true;
   }
 
@@ -565,13 +2263,13 @@ Spi::get_if_no_args(
 
 bool
 Spi::get_argument_greater_than(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int offset,
   int target,
   int& value
 ) {
-  if (!get_argument(isolate, args, offset, value)) { return false; }
+  if (!get_argument(env, args, offset, value)) { return false; }
 
   if (value <= target) {
     EXCEPTION(ERROR_OUT_OF_RANGE(offset, value, >, target));
@@ -581,16 +2279,246 @@ Spi::get_argument_greater_than(
   return true;
 }
 
-void
+// address, data
+bool
+Spi::get_bit_image(
+  napi_env env,
+  const CallArgs& args,
+  int offset,
+  uint16_t& address,
+  const uint8_t*& data,
+  uint16_t& size
+) {
+  int in_address;
+  if (!get_argument(env, args, offset, in_address)) { return false; }
+  if (args.Length() <= (size_t)offset + 1 || !is_buffer(env, args[offset + 1])) {
+    EXCEPTION("Image data must be a Buffer");
+    return false;
+  }
+
+  size_t length = buffer_length(env, args[offset + 1]);
+  if (in_address < 0 || in_address > 0xffff || length > 0xffff) {
+    EXCEPTION("Bit image outside display memory");
+    return false;
+  }
+
+  address = in_address;
+  data = (const uint8_t *)buffer_data(env, args[offset + 1]);
+  size = length;
+  return true;
+}
+
+// x, y, width, height, data; returned in columns and byte rows
+bool
+Spi::get_window(
+  napi_env env,
+  const CallArgs& args,
+  int offset,
+  uint32_t& x,
+  uint32_t& row,
+  uint32_t& width,
+  uint32_t& rows,
+  const uint8_t*& data
+) {
+  int in_x, in_y, in_width, in_height;
+  if (!get_argument(env, args, offset, in_x)) { return false; }
+  if (!get_argument(env, args, offset + 1, in_y)) { return false; }
+  if (!get_argument_greater_than(env, args, offset + 2, 0, in_width)) { return false; }
+  if (!get_argument_greater_than(env, args, offset + 3, 0, in_height)) { return false; }
+
+  if (in_y % 8 || in_height % 8) {
+    EXCEPTION("Window y and height must be multiples of 8");
+    return false;
+  }
+  if (in_x < 0 || in_y < 0 ||
+      (uint32_t)(in_x + in_width) > display_width() ||
+      (uint32_t)(in_y + in_height) > display_rows() * 8) {
+    EXCEPTION("Window outside the display");
+    return false;
+  }
+
+  if (args.Length() <= (size_t)offset + 4 || !is_buffer(env, args[offset + 4])) {
+    EXCEPTION("Image data must be a Buffer");
+    return false;
+  }
+  if (buffer_length(env, args[offset + 4]) != (size_t)in_width * in_height / 8) {
+    EXCEPTION("Image data size does not match the window");
+    return false;
+  }
+
+  x = in_x;
+  row = in_y / 8;
+  width = in_width;
+  rows = in_height / 8;
+  data = (const uint8_t *)buffer_data(env, args[offset + 4]);
+  return true;
+}
+
+// src, width, height, format, stride
+bool
+Spi::get_canvas(
+  napi_env env,
+  const CallArgs& args,
+  int offset,
+  const uint8_t*& src,
+  uint32_t& width,
+  uint32_t& height,
+  int& format,
+  size_t& stride
+) {
+  if (args.Length() <= (size_t)offset || !is_buffer(env, args[offset])) {
+    EXCEPTION("Canvas must be a Buffer");
+    return false;
+  }
+  napi_value src_obj = args[offset];
+
+  int in_width, in_height, in_stride;
+  if (!get_argument_greater_than(env, args, offset + 1, 0, in_width)) { return false; }
+  if (!get_argument_greater_than(env, args, offset + 2, 0, in_height)) { return false; }
+  if (!get_argument(env, args, offset + 3, format)) { return false; }
+  if (!get_argument(env, args, offset + 4, in_stride)) { return false; }
+
+  if (format != PACK_GRAY && format != PACK_RGBA) {
+    EXCEPTION("Format must be 1 (gray) or 4 (RGBA)");
+    return false;
+  }
+  if (in_height % 8) {
+    EXCEPTION("Height must be a multiple of 8");
+    return false;
+  }
+  if (in_stride < in_width * format) {
+    EXCEPTION("Stride shorter than a row");
+    return false;
+  }
+  if (buffer_length(env, src_obj) < (size_t)in_stride * (in_height - 1) + in_width * format) {
+    EXCEPTION("Canvas smaller than width, height and stride");
+    return false;
+  }
+
+  src = (const uint8_t *)buffer_data(env, src_obj);
+  width = in_width;
+  height = in_height;
+  stride = in_stride;
+  return true;
+}
+
+// Optional [frame, x, y] for the packers. Without a frame, allocates a
+// Buffer for a standalone width x height image.
+bool
+Spi::get_frame_target(
+  napi_env env,
+  const CallArgs& args,
+  int offset,
+  uint32_t width,
+  uint32_t height,
+  napi_value& out,
+  uint8_t*& dest,
+  uint32_t& out_rows
+) {
+  if (args.Length() <= (size_t)offset) {
+    out = new_buffer(env, width * height / 8);
+    dest = (uint8_t *)buffer_data(env, out);
+    out_rows = height / 8;
+    return true;
+  }
+
+  if (!is_buffer(env, args[offset])) {
+    EXCEPTION("Frame must be a Buffer");
+    return false;
+  }
+  out = args[offset];
+  if (buffer_length(env, out) != display_width() * display_rows()) {
+    EXCEPTION("Frame size does not match the display");
+    return false;
+  }
+
+  int x = 0, y = 0;
+  if (args.Length() > (size_t)offset + 1 && !get_argument(env, args, offset + 1, x)) { return false; }
+  if (args.Length() > (size_t)offset + 2 && !get_argument(env, args, offset + 2, y)) { return false; }
+  if (y % 8) {
+    EXCEPTION("y must be a multiple of 8");
+    return false;
+  }
+  if (x < 0 || y < 0 || x + width > display_width() || y + height > display_rows() * 8) {
+    EXCEPTION("Image outside the display");
+    return false;
+  }
+
+  out_rows = display_rows();
+  dest = (uint8_t *)buffer_data(env, out) + ntk_address(out_rows, x, y);
+  return true;
+}
+
+// Layer id, checked against the compositor
+bool
+Spi::get_layer(
+  napi_env env,
+  const CallArgs& args,
+  int& id
+) {
+  if (!m_compositor) {
+    EXCEPTION("Call framebuffer(width, height) first");
+    return false;
+  }
+  if (!get_argument(env, args, 0, id)) { return false; }
+  if (!m_compositor->has(id)) {
+    EXCEPTION("Unknown layer");
+    return false;
+  }
+  return true;
+}
+
+// Optional out buffer and offset for the encoders. Without one, allocates a
+// Buffer of exactly size bytes.
+bool
+Spi::get_output(
+  napi_env env,
+  const CallArgs& args,
+  int offset,
+  size_t size,
+  napi_value& out,
+  size_t& out_offset
+) {
+  if (args.Length() <= (size_t)offset) {
+    out = new_buffer(env, size);
+    out_offset = 0;
+    return true;
+  }
+
+  if (!is_buffer(env, args[offset])) {
+    EXCEPTION("Output must be a Buffer");
+    return false;
+  }
+  out = args[offset];
+
+  int in_offset = 0;
+  if (args.Length() > (size_t)offset + 1) {
+    if (!get_argument(env, args, offset + 1, in_offset)) { return false; }
+    if (in_offset < 0) {
+      EXCEPTION("Output offset must not be negative");
+      return false;
+    }
+  }
+  if (in_offset + size > buffer_length(env, out)) {
+    EXCEPTION("Output buffer too small");
+    return false;
+  }
+
+  out_offset = in_offset;
+  return true;
+}
+
+napi_value
 Spi::get_set_mode_toggle(
-  Isolate *isolate,
-  const FunctionCallbackInfo<Value>& args,
+  napi_env env,
+  const CallArgs& args,
   int mask
 ) {
-    if (get_if_no_args(isolate, args, 0, (m_mode&mask) > 0)) { return; }
+    napi_value result;
+    if (get_if_no_args(env, args, 0, (m_mode&mask) > 0, result)) { return result; }
 
     bool in_value;
-    if (!get_argument(isolate, args, 0, in_value)) { return; }
+    if (!get_argument(env, args, 0, in_value)) { return NULL; }
 
     if (in_value) {                                                              
       m_mode |= mask;                                                  
@@ -599,4 +2527,3 @@ Spi::get_set_mode_toggle(
     }                                                                            
     FUNCTION_CHAIN;                                                              
 }
-
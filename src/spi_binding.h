@@ -16,66 +16,89 @@
 
 #pragma once
 
-#include <v8.h>
-#include <node.h>
-#include <node_object_wrap.h>
+#include <node_api.h>
 
-using namespace v8;
-using namespace node;
+#include <deque>
+#include <vector>
 
-#define SPI_FUNC(NAME) static void NAME (const FunctionCallbackInfo<Value>& args)
-#define SPI_FUNC_IMPL(NAME) void Spi::NAME (const FunctionCallbackInfo<Value>& args)
-#define SPI_FUNC_EMPTY(NAME) void Spi::NAME (const FunctionCallbackInfo<Value>& args) { \
-    args.GetReturnValue().Set(false);  \
-}
+#include "spi_device.h"
+
+class Font;
+
+#define SPI_FUNC(NAME) static napi_value NAME (napi_env env, napi_callback_info info)
+#define SPI_FUNC_IMPL(NAME) napi_value Spi::NAME (napi_env env, napi_callback_info info)
+
+// Most calls take fewer; Pack() and Dither() take 9
+#define SPI_MAX_ARGS 10
+
+// The arguments and receiver of a call. Arguments past the ones passed are
+// undefined.
+class CallArgs {
+    public:
+        CallArgs(napi_env env, napi_callback_info info);
+
+        size_t Length() const { return m_length; }
+        napi_value This() const { return m_this; }
+        napi_value operator[](size_t i) const { return i < m_length ? m_argv[i] : m_undefined; }
+
+    private:
+        size_t m_length;
+        napi_value m_this;
+        napi_value m_argv[SPI_MAX_ARGS];
+        napi_value m_undefined;
+};
 
-#define BCM2708_PERI_BASE        0x3F000000
-#define GPIO_BASE                (BCM2708_PERI_BASE + 0x200000) /* GPIO controller */
-
-#define PAGE_SIZE (4*1024)
-#define BLOCK_SIZE (4*1024)
- 
-// I/O access
-volatile unsigned *gpio;
-void *gpio_map;
-
-// GPIO setup macros. Always use INP_GPIO(x) before using OUT_GPIO(x) or SET_GPIO_ALT(x,y)
-#define INP_GPIO(g) *(gpio+((g)/10)) &= ~(7<<(((g)%10)*3))
-#define OUT_GPIO(g) *(gpio+((g)/10)) |=  (1<<(((g)%10)*3))
-#define SET_GPIO_ALT(g,a) *(gpio+(((g)/10))) |= (((a)<=3?(a)+4:(a)==4?3:2)<<(((g)%10)*3))
- 
-#define GPIO_SET *(gpio+7)  // sets   bits which are 1 ignores bits which are 0
-#define GPIO_CLR *(gpio+10) // clears bits which are 1 ignores bits which are 0
- 
-#define GET_GPIO(g) (*(gpio+13)&(1<<g)) // 0 if LOW, (1<<g) if HIGH
- 
-#define GPIO_PULL *(gpio+37) // Pull up/pull down
-#define GPIO_PULLCLK0 *(gpio+38) // Pull up/pull down clock
-
-
-class Spi : public ObjectWrap {
+// What each Node environment, the main thread or a worker, keeps apart
+// from the others
+struct AddonData {
+  napi_ref constructor;
+  std::vector<Font *> fonts;   // by id, 0 being the built-in font
+};
+
+// An async call waiting for its turn on the devices it uses. It goes to the
+// thread pool once it heads the queue of every one of them.
+struct AsyncJob {
+  napi_async_work request;
+  size_t waiting;   // devices on which an earlier call is still queued
+};
+
+class Spi : public SpiDevice {
     public:
-        static Persistent<Function> constructor;
-        static void Initialize(Handle<Object> target);
+        static napi_value Initialize(napi_env env, napi_value exports);
+
+        // The Spi behind a JS object, or NULL with a TypeError thrown
+        static Spi *unwrap(napi_env env, napi_value object);
 
     private:
-        Spi() : m_fd(-1),
-	        m_mode(0),
-	        m_max_speed(1000000),  // default speed in Hz () 1MHz
-	        m_delay(0),            // expose delay to options
-	        m_bits_per_word(8),    // default bits per word
-                m_wr_pin(0),
-                m_rdy_pin(0),
-                m_invert_rdy(false) {}   // RDY is RDY, not BUSY
+        Spi(napi_env env) : m_env(env), m_wrapper(NULL) {}
+          ~Spi() { } // SpiDevice closes the device
 
+        static void Finalize(napi_env env, void *data, void *hint);
 
+        // Keeps the JS object alive while a transfer or the transmit engine
+        // uses it, like ObjectWrap::Ref()
+        void Ref();
+        void Unref();
 
-          ~Spi() { } // Probably close fd if it's open
+        // Async calls run one at a time per device, in the order they were
+        // made. schedule() queues job on each device and finish() starts
+        // whatever was waiting for it.
+        static void schedule(napi_env env, AsyncJob &job, const std::vector<Spi *> &devices);
+        static void finish(napi_env env, AsyncJob &job, const std::vector<Spi *> &devices);
+        void schedule(napi_env env, AsyncJob &job) { schedule(env, job, std::vector<Spi *>(1, this)); }
+        void finish(napi_env env, AsyncJob &job) { finish(env, job, std::vector<Spi *>(1, this)); }
+
+        napi_env m_env;
+        napi_ref m_wrapper;
+        std::deque<AsyncJob *> m_jobs;   // the running call first
 
         SPI_FUNC(New);
         SPI_FUNC(Open);
         SPI_FUNC(Close);
         SPI_FUNC(Transfer);
+        SPI_FUNC(Transferv);
+        SPI_FUNC(Queue);
+        SPI_FUNC(Flush);
         SPI_FUNC(GetSetMode);
         SPI_FUNC(GetSetChipSelect);
         SPI_FUNC(GetSetMaxSpeed);
@@ -86,61 +109,100 @@ class Spi : public ObjectWrap {
         SPI_FUNC(GetSetBitsPerWord);
         SPI_FUNC(GetSetWrPin);
         SPI_FUNC(GetSetRdyPin);
+        SPI_FUNC(GetSetCsStrobe);
         SPI_FUNC(GetSetInvertRdy);
         SPI_FUNC(GetSetbSeries);
-
-        void full_duplex_transfer(Isolate* isolate, const FunctionCallbackInfo<Value> &args, char *write, char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits);
-        bool require_arguments(Isolate* isolate, const FunctionCallbackInfo<Value>& args, int count);
-        bool get_argument(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int offset, int& value);
-        bool get_argument(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int offset, bool& value);
-        bool get_argument_greater_than(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int offset, int target, int& value);
-        bool get_if_no_args(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int offset, unsigned int value);
-        bool get_if_no_args(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int offset, bool value);
-
-        void get_set_mode_toggle(Isolate *isolate, const FunctionCallbackInfo<Value>& args, int mask);
-
-        int m_fd;
-        uint32_t m_mode;
-        uint32_t m_max_speed;
-        uint16_t m_delay;
-        uint8_t m_bits_per_word;
-        uint32_t m_wr_pin;
-        uint32_t m_rdy_pin;
-        bool m_bseries;
-        bool m_invert_rdy;
+        SPI_FUNC(GetSetBurst);
+        SPI_FUNC(GetSetSettle);
+        SPI_FUNC(GetSetRdySpin);
+        SPI_FUNC(GetSetRdyTimeout);
+        SPI_FUNC(Timing);
+        SPI_FUNC(Stats);
+        SPI_FUNC(ResetStats);
+        SPI_FUNC(Trace);
+        SPI_FUNC(TraceJson);
+        SPI_FUNC(GetSetTransport);
+        SPI_FUNC(GetSetDataPins);
+        SPI_FUNC(Simulator);
+        SPI_FUNC(EngineStart);
+        SPI_FUNC(EngineStop);
+        SPI_FUNC(EngineStatus);
+        SPI_FUNC(Submit);
+        SPI_FUNC(Present);
+        SPI_FUNC(SetFramebuffer);
+        SPI_FUNC(Commit);
+        SPI_FUNC(Invalidate);
+        SPI_FUNC(AddLayer);
+        SPI_FUNC(RemoveLayer);
+        SPI_FUNC(LayerBitmap);
+        SPI_FUNC(MoveLayer);
+        SPI_FUNC(Layer);
+        SPI_FUNC(Compose);
+        SPI_FUNC(CommitLayers);
+        SPI_FUNC(Address);
+        SPI_FUNC(EncodeBitImage);
+        SPI_FUNC(EncodeWindow);
+        SPI_FUNC(WriteBitImage);
+        SPI_FUNC(WriteWindow);
+        SPI_FUNC(Pack);
+        SPI_FUNC(Dither);
+        SPI_FUNC(Text);
+
+        // loadFont(buffer) and textWidth(font, string), on the module
+        SPI_FUNC(LoadFont);
+        SPI_FUNC(TextWidth);
+
+        // interleave([spi, ...], [buffer, ...][, callback]), on the module
+        SPI_FUNC(Interleave);
+        static void interleave_work(napi_env env, void *data);
+        static void interleave_after(napi_env env, napi_status status, void *data);
+
+        static void transfer_work(napi_env env, void *data);
+        static void transfer_after(napi_env env, napi_status status, void *data);
+
+        SPI_FUNC(Autotune);
+        static void autotune_work(napi_env env, void *data);
+        static void autotune_after(napi_env env, napi_status status, void *data);
+
+        bool require_arguments(napi_env env, const CallArgs& args, int count);
+        bool get_argument(napi_env env, const CallArgs& args, int offset, int& value);
+        bool get_argument(napi_env env, const CallArgs& args, int offset, bool& value);
+        bool get_argument_greater_than(napi_env env, const CallArgs& args, int offset, int target, int& value);
+        bool get_if_no_args(napi_env env, const CallArgs& args, int offset, unsigned int value, napi_value& result);
+        bool get_if_no_args(napi_env env, const CallArgs& args, int offset, bool value, napi_value& result);
+
+        bool get_bit_image(napi_env env, const CallArgs& args, int offset,
+                           uint16_t& address, const uint8_t*& data, uint16_t& size);
+        bool get_window(napi_env env, const CallArgs& args, int offset,
+                        uint32_t& x, uint32_t& row, uint32_t& width, uint32_t& rows, const uint8_t*& data);
+        bool get_canvas(napi_env env, const CallArgs& args, int offset,
+                        const uint8_t*& src, uint32_t& width, uint32_t& height, int& format, size_t& stride);
+        bool get_frame_target(napi_env env, const CallArgs& args, int offset,
+                              uint32_t width, uint32_t height, napi_value& out, uint8_t*& dest, uint32_t& out_rows);
+        bool get_layer(napi_env env, const CallArgs& args, int& id);
+        bool get_output(napi_env env, const CallArgs& args, int offset,
+                        size_t size, napi_value& out, size_t& out_offset);
+
+        napi_value get_set_mode_toggle(napi_env env, const CallArgs& args, int mask);
 };
 
-#define EXCEPTION(X) isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, X)))
+#define EXCEPTION(X) napi_throw_type_error(env, NULL, X)
 
 #define FUNCTION_PREAMBLE                          \
-             Isolate* isolate = args.GetIsolate(); \
-             HandleScope scope(isolate);           \
-             Spi* self = ObjectWrap::Unwrap<Spi>(args.This())
-
-#define FUNCTION_CHAIN args.GetReturnValue().Set(args.This())
+             CallArgs args(env, info);             \
+             Spi* self = Spi::unwrap(env, args.This()); \
+             if (!self) { return NULL; }
 
-#define ASSERT_OPEN if (self->m_fd == -1) { EXCEPTION("Device not opened"); return; } 
-#define ASSERT_NOT_OPEN if (self->m_fd != -1) { EXCEPTION("Cannot be called once device is opened"); return; }
-#define ONLY_IF_OPEN if (self->m_fd == -1) { FUNCTION_CHAIN; return; }
+#define FUNCTION_CHAIN return args.This()
 
-#define REQ_INT_ARG_GT(I, NAME, VAR, VAL)                                      \
-  REQ_INT_ARG(I, VAR);                                                         \
-  if (VAR <= VAL)                                                              \
-    return ThrowException(Exception::TypeError(                                \
-       String::NewFromUtf8(isolate, #NAME " must be greater than " #VAL )));
+#define ASSERT_OPEN if (!self->m_open) { EXCEPTION("Device not opened"); return NULL; }
+#define ASSERT_NOT_OPEN if (self->m_open) { EXCEPTION("Cannot be called once device is opened"); return NULL; }
+#define ONLY_IF_OPEN if (!self->m_open) { FUNCTION_CHAIN; }
 
 #define SPI_FUNC_BOOLEAN_TOGGLE_IMPL(NAME, ARGUMENT)                           \
 SPI_FUNC_IMPL(NAME) {                                                          \
   FUNCTION_PREAMBLE;                                                           \
-  self->get_set_mode_toggle(isolate, args, ARGUMENT);                          \
+  return self->get_set_mode_toggle(env, args, ARGUMENT);                       \
 }
 
-#define SET_IOCTL_VALUE(FD, CTRL, VALUE)                                       \
-  retval = ioctl(FD, CTRL, &(VALUE));                                          \
-  if (retval == -1) {                                                          \
-    EXCEPTION("Unable to set " #CTRL);                                         \
-    return;                                                                    \
-  }
-
 #define MAX(a,b) (a>b ? a:b)
-
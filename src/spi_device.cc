@@ -0,0 +1,881 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "spi_device.h"
+#include "delay.h"
+#include "ntk3900.h"
+#include "ntk_encoder.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <algorithm>
+
+SpiDevice::SpiDevice() :
+        m_open(false),
+        m_mode(0),
+        m_max_speed(1000000),  // default speed in Hz () 1MHz
+        m_delay(0),            // expose delay to options
+        m_bits_per_word(8),    // default bits per word
+        m_wr_pin(0),
+        m_rdy_pin(0),
+        m_cs_strobe(false),    // !WR strobed through wrPin
+        m_bseries(false),
+        m_invert_rdy(false),   // RDY is RDY, not BUSY
+        m_burst(1),            // full handshake on every byte
+        m_settle_ns(0),        // series default
+        m_rdy_spin_ns(0),      // series default
+        m_rdy_timeout_ms(RDY_TIMEOUT_MS),
+        m_data_pins(),         // parallel transport only
+        m_ring(NULL),
+        m_engine_running(false),
+        m_engine_stop(false),
+        m_engine_queued_bytes(0),
+        m_engine_sent_frames(0),
+        m_engine_sent_bytes(0),
+        m_engine_errors(0),
+        m_present_buffers(2),
+        m_present_frames(0),
+        m_present_presented(0),
+        m_present_dropped(0),
+        m_present_torn(0),
+        m_ready_at(0),
+        m_trace(NULL),
+        m_transport(new SpidevTransport()),
+        m_sim(NULL),
+        m_framebuffer(NULL),
+        m_compositor(NULL),
+        m_composited(false) {
+  for (int i = 0; i < PRESENT_MAX_BUFFERS; i++) {
+    m_present[i].state = PRESENT_FREE;
+  }
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_mutex_init(&m_engine_wait, NULL);
+  pthread_cond_init(&m_engine_cond, NULL);
+}
+
+SpiDevice::~SpiDevice() {
+  close();
+  pthread_cond_destroy(&m_engine_cond);
+  pthread_mutex_destroy(&m_engine_wait);
+  pthread_mutex_destroy(&m_lock);
+  delete m_transport;
+  delete m_framebuffer;
+  delete m_compositor;
+  delete m_trace;
+}
+
+const char *SpiDevice::open(const char *device) {
+  if (m_cs_strobe && (m_mode & SPI_NO_CS)) {
+    return "csStrobe needs the chip select line";
+  }
+
+  LinkConfig config;
+  config.mode = m_mode;
+  config.bits_per_word = m_bits_per_word;
+  config.max_speed = m_max_speed;
+  config.wr_pin = m_wr_pin;
+  config.rdy_pin = m_rdy_pin;
+  config.invert_rdy = m_invert_rdy;
+  config.bseries = m_bseries;
+  config.cs_strobe = m_cs_strobe;
+  memcpy(config.data_pins, m_data_pins, sizeof(config.data_pins));
+
+  const char *error = m_transport->open(device, config);
+  if (error) { return error; }
+
+  m_open = true;
+  return NULL;
+}
+
+// "spidev" talks to the real display through the 74HC595, "spi0" does the
+// same with the SPI controller driven from userspace, "parallel" drives its
+// data lines from GPIO pins, "sim" talks to an in-process simulated one
+const char *SpiDevice::set_transport(const char *name) {
+  Transport *transport = NULL;
+  SimTransport *sim = NULL;
+
+  if (!strcmp(name, "spidev")) {
+    transport = new SpidevTransport();
+  } else if (!strcmp(name, "spi0")) {
+    transport = new Spi0Transport();
+  } else if (!strcmp(name, "parallel")) {
+    transport = new ParallelTransport();
+  } else if (!strcmp(name, "sim")) {
+    transport = sim = new SimTransport();
+  } else {
+    return "Unknown transport";
+  }
+
+  delete m_transport;
+  m_transport = transport;
+  m_sim = sim;
+  return NULL;
+}
+
+void SpiDevice::close() {
+  if (!m_open) { return; }
+
+  // Let the transmit engine drain its queue, then wait for any other
+  // transfer in progress to finish
+  engine_stop();
+  pthread_mutex_lock(&m_lock);
+  m_transport->close();
+  m_open = false;
+  pthread_mutex_unlock(&m_lock);
+}
+
+int SpiDevice::transfer(char *write, char *read, size_t length) {
+  TxSegment segment = { write, length };
+  pthread_mutex_lock(&m_lock);
+  int ret = locked_transfer(&segment, read, length);
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+int SpiDevice::transferv(const TxSegment *segments, size_t count) {
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++) { length += segments[i].length; }
+  pthread_mutex_lock(&m_lock);
+  int ret = locked_transfer(segments, NULL, length);
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+// Adds a command, or a short run of text, to the command queue
+void SpiDevice::queue_command(const uint8_t *data, size_t length) {
+  pthread_mutex_lock(&m_lock);
+  m_stats.commands_queued.add(1);
+  m_stats.commands_dropped.add(m_commands.push(data, length));
+  pthread_mutex_unlock(&m_lock);
+}
+
+// Sends everything queued as one transfer. Returns the bytes sent, 0 when
+// there was nothing left to send, or an XFER_ERR code.
+int SpiDevice::flush() {
+  pthread_mutex_lock(&m_lock);
+  int ret = 0;
+  if (!m_commands.empty()) {
+    CommandState state;
+    m_stats.commands_dropped.add(m_commands.take(m_flush_buf, state));
+    if (!m_flush_buf.empty()) {
+      TxSegment segment = { (const char *)&m_flush_buf[0], m_flush_buf.size() };
+      ret = locked_transfer(&segment, NULL, segment.length);
+      if (ret >= 0) { m_commands.sent(state); }
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+// Address of the next byte of a gather list, 0 in a NULL segment. index and
+// offset start at 0 and must not go past the end of the list.
+static unsigned long next_tx_byte(const TxSegment *segments, size_t &index, size_t &offset) {
+  while (offset == segments[index].length) {
+    index++;
+    offset = 0;
+  }
+  const char *data = segments[index].data;
+  unsigned long address = data ? (unsigned long)(data + offset) : 0;
+  offset++;
+  return address;
+}
+
+int SpiDevice::locked_transfer(const TxSegment *segments, char *read, size_t length) {
+  // Whatever goes out may change what the command queue thinks the display
+  // is set to
+  m_commands.forget();
+
+  int ret = XFER_ERR_CLOSED;
+  if (m_open) {
+    uint64_t start = delay_now_ns();
+    ret = length ? full_duplex_transfer(segments, read, length,
+                                        m_max_speed, m_delay, m_bits_per_word) : 0;
+    uint64_t end = delay_now_ns();
+    uint64_t elapsed = end - start;
+    trace(TRACE_TRANSFER, start, end, ret < 0 ? 0 : ret);
+
+    m_stats.transfers.add(1);
+    m_stats.transfer_ns.add(elapsed);
+    if (ret < 0) {
+      m_stats.errors.add(1);
+    } else {
+      m_stats.bytes.add(ret);
+      if (elapsed) { m_stats.bytes_per_sec.add(ret * 1000000000ULL / elapsed); }
+    }
+  } else {
+    m_stats.errors.add(1);
+  }
+  return ret;
+}
+
+void SpiDevice::reset_stats() {
+  pthread_mutex_lock(&m_lock);
+  m_stats.reset();
+  pthread_mutex_unlock(&m_lock);
+}
+
+// Starts tracing into a fresh ring of capacity records, or stops with 0
+void SpiDevice::set_trace(size_t capacity) {
+  TraceBuffer *trace = capacity ? new TraceBuffer(capacity) : NULL;
+
+  pthread_mutex_lock(&m_lock);
+  TraceBuffer *old = m_trace;
+  m_trace = trace;
+  pthread_mutex_unlock(&m_lock);
+
+  delete old;
+}
+
+// False if tracing is off
+bool SpiDevice::trace_json(int pid, std::string &json) {
+  pthread_mutex_lock(&m_lock);
+  if (m_trace) { json = m_trace->chrome_json(pid); }
+  bool tracing = m_trace != NULL;
+  pthread_mutex_unlock(&m_lock);
+  return tracing;
+}
+
+const char *SpiDevice::transfer_error(int code) {
+  switch (code) {
+    case XFER_ERR_IOCTL:  return "Unable to send SPI message";
+    case XFER_ERR_CLOSED: return "Device not opened";
+    case XFER_ERR_TIMEOUT: return "Display not ready (RDY timeout)";
+    case XFER_ERR_RESIZED: return "Framebuffer changed size before the commit ran";
+    default:              return "Transfer failed";
+  }
+}
+
+// width columns of height dots, height a multiple of 8. The first commit
+// after this sends the whole frame.
+const char *SpiDevice::set_framebuffer(uint32_t width, uint32_t height) {
+  if (!width || !height || height % 8) {
+    return "Framebuffer height must be a multiple of 8";
+  }
+  if (width * (height / 8) > 0xffff) {
+    return "Framebuffer too large";
+  }
+  if (m_engine_running) {
+    return "Cannot change the framebuffer while the transmit engine runs";
+  }
+
+  // A commit on the thread pool may be using the shadow
+  Framebuffer *framebuffer = new Framebuffer(width, height);
+  pthread_mutex_lock(&m_lock);
+  std::swap(m_framebuffer, framebuffer);
+  m_composited = false;
+  pthread_mutex_unlock(&m_lock);
+  delete framebuffer;
+
+  delete m_compositor;
+  m_compositor = new Compositor(width, height);
+  m_changed.clear();
+  return NULL;
+}
+
+// Composes the layers and sends the columns that changed. The compositor
+// knows exactly which columns those are, as long as the shadow holds its
+// previous frame.
+uint32_t SpiDevice::compose_layers() {
+  return m_compositor->compose(m_changed);
+}
+
+int SpiDevice::commit_layers() {
+  compose_layers();
+  int ret = commit(m_compositor->frame(), m_compositor->size(), m_encode_buf, &m_changed[0]);
+  m_changed.assign(m_changed.size(), 0);
+  return ret;
+}
+
+int SpiDevice::commit(const uint8_t *frame) {
+  return commit(frame, m_framebuffer->size(), m_encode_buf);
+}
+
+// Diffs frame against the shadow and sends the changes, encoded into out for
+// the series the device is set up for. Both happen under m_lock, so the
+// shadow always matches what reached the display, whichever thread commits.
+// A composed frame comes with the columns changed since the last one, and
+// only those are diffed while the shadow holds that frame.
+int SpiDevice::commit(const uint8_t *frame, size_t size, std::vector<uint8_t> &out,
+                      const uint8_t *changed) {
+  pthread_mutex_lock(&m_lock);
+  int ret = 0;
+  if (size != m_framebuffer->size()) {
+    ret = XFER_ERR_RESIZED;
+  } else {
+    const uint8_t *columns = (changed && m_composited) ? changed : NULL;
+    m_composited = changed != NULL;
+    size_t length = m_framebuffer->update(frame, bseries_commands(), out, columns);
+    if (length) {
+      TxSegment segment = { (const char *)&out[0], length };
+      ret = locked_transfer(&segment, NULL, length);
+      if (ret < 0) { m_framebuffer->invalidate(); }
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+  return ret;
+}
+
+void SpiDevice::invalidate() {
+  pthread_mutex_lock(&m_lock);
+  if (m_framebuffer) { m_framebuffer->invalidate(); }
+  pthread_mutex_unlock(&m_lock);
+}
+
+uint32_t SpiDevice::display_width() const {
+  return m_framebuffer ? m_framebuffer->width() : NTK_WIDTH;
+}
+
+uint32_t SpiDevice::display_rows() const {
+  return (m_framebuffer ? m_framebuffer->height() : NTK_HEIGHT) / 8;
+}
+
+int SpiDevice::write_bit_image(uint16_t address, const uint8_t *data, uint16_t size) {
+  m_encode_buf.resize(NTK_BIT_IMAGE_HEADER + size);
+  size_t length = ntk_bit_image(&m_encode_buf[0], address, data, size);
+  return transfer((char *)&m_encode_buf[0], NULL, length);
+}
+
+int SpiDevice::write_window(uint32_t x, uint32_t row, uint32_t width, uint32_t rows, const uint8_t *data) {
+  bool bseries = bseries_commands();
+  m_encode_buf.resize(ntk_window_size(bseries, display_rows(), width, rows));
+  size_t length = ntk_window(&m_encode_buf[0], bseries, display_rows(), x, row, width, rows, data);
+  return transfer((char *)&m_encode_buf[0], NULL, length);
+}
+
+int SpiDevice::full_duplex_transfer(
+  const TxSegment *segments,
+  char *read,
+  size_t length,
+  uint32_t speed,
+  uint16_t delay,
+  uint8_t bits
+) {
+  struct spi_ioc_transfer data = {
+	  0,
+	  (unsigned long)read,
+	  1,
+	  speed,
+	  delay,
+	  bits,
+    0,   // cs_change
+    0,  // tx_nbits
+    0,  // rx_nbits
+    0   // pad
+  };
+
+  if (m_cs_strobe) {
+    return cs_strobe_transfer(segments, read, length, speed, delay, bits);
+  }
+
+  size_t sent = 0;
+  size_t index = 0, offset = 0;
+
+  m_transport->pin_set(m_wr_pin);
+
+  if (!wait_rdy()) {
+    return XFER_ERR_TIMEOUT;
+  }
+
+  // Now send byte by byte for the whole buffer
+  size_t burst = 0;
+  while (sent < length) {
+    data.tx_buf = next_tx_byte(segments, index, offset);
+    uint64_t start = delay_now_ns();
+    int ret = m_transport->message(&data, 1);
+    uint64_t sent_at = delay_now_ns();
+    m_stats.ioctls.add(1);
+    m_stats.ioctl_ns.add(sent_at - start);
+    trace(TRACE_IOCTL, start, sent_at, 1);
+    if (ret == -1) {
+      return XFER_ERR_IOCTL;
+    }
+
+    if (m_wr_pin) {
+      m_transport->pin_clr(m_wr_pin);
+      m_transport->pin_set(m_wr_pin);
+      uint64_t strobed_at = delay_now_ns();
+      m_stats.strobes.add(1);
+      m_stats.strobe_ns.add(strobed_at - sent_at);
+      trace(TRACE_STROBE, sent_at, strobed_at, 0);
+    }
+
+    if (read) { data.rx_buf++; }
+    sent++;
+
+    // In burst mode the display input buffer still has room for the next
+    // bytes of the burst, so we skip the settle delay and the RDY wait until
+    // the burst is over. RDY is not looked at in between: right after the
+    // strobe it still shows the level from before the byte, so it cannot
+    // tell whether the buffer filled up. Only its depth can.
+    if (++burst < m_burst) {
+      continue;
+    }
+    burst = 0;
+
+    if (!handshake()) {
+      return XFER_ERR_TIMEOUT;
+    }
+   }
+
+  return sent;
+}
+
+void SpiDevice::interleave_begin() {
+  if (m_wr_pin && !m_cs_strobe) {
+    m_transport->pin_set(m_wr_pin);
+  }
+  m_commands.forget();
+  // The last byte of the previous run may still be settling
+  uint64_t now = delay_now_ns();
+  if (m_ready_at < now) { m_ready_at = now; }
+}
+
+bool SpiDevice::interleave_ready(uint64_t now) {
+  return now >= m_ready_at && rdy_asserted();
+}
+
+// True once the display has been busy for longer than the RDY timeout
+bool SpiDevice::interleave_stalled(uint64_t now) const {
+  return m_rdy_timeout_ms && now > m_ready_at + m_rdy_timeout_ms * 1000000ULL;
+}
+
+// Sends one byte and strobes it in, without waiting for the display
+int SpiDevice::interleave_send(const char *byte) {
+  struct spi_ioc_transfer data;
+  memset(&data, 0, sizeof(data));
+  data.tx_buf = (unsigned long)byte;
+  data.len = 1;
+  data.speed_hz = m_max_speed;
+  data.delay_usecs = m_delay;
+  data.bits_per_word = m_bits_per_word;
+
+  uint64_t start = delay_now_ns();
+  int ret = m_transport->message(&data, 1);
+  uint64_t sent_at = delay_now_ns();
+  m_stats.ioctls.add(1);
+  m_stats.ioctl_ns.add(sent_at - start);
+  trace(TRACE_IOCTL, start, sent_at, 1);
+  if (ret == -1) {
+    return XFER_ERR_IOCTL;
+  }
+
+  uint64_t strobed_at = sent_at;
+  if (m_wr_pin && !m_cs_strobe) {
+    m_transport->pin_clr(m_wr_pin);
+    m_transport->pin_set(m_wr_pin);
+    strobed_at = delay_now_ns();
+    m_stats.strobe_ns.add(strobed_at - sent_at);
+    trace(TRACE_STROBE, sent_at, strobed_at, 0);
+  }
+  m_stats.strobes.add(1);
+
+  m_ready_at = strobed_at + settle_ns();
+  return 1;
+}
+
+void SpiDevice::interleave_end(int result, uint64_t start, uint64_t end) {
+  trace(TRACE_TRANSFER, start, end, result < 0 ? 0 : result);
+  m_stats.transfers.add(1);
+  m_stats.transfer_ns.add(end - start);
+  if (result < 0) {
+    m_stats.errors.add(1);
+  } else {
+    m_stats.bytes.add(result);
+    if (end > start) { m_stats.bytes_per_sec.add(result * 1000000000ULL / (end - start)); }
+  }
+}
+
+// Transfer for the csStrobe wiring: the chip select edge latches the 74HC595
+// and strobes !WR, so a whole burst goes out as one SPI message with one
+// segment per byte and no userspace GPIO work between bytes. delay_usecs on
+// every segment covers the display write cycle.
+int SpiDevice::cs_strobe_transfer(
+  const TxSegment *segments,
+  char *read,
+  size_t length,
+  uint32_t speed,
+  uint16_t delay,
+  uint8_t bits
+) {
+  struct spi_ioc_transfer messages[MAX_BURST];
+  memset(messages, 0, sizeof(messages));
+
+  size_t sent = 0;
+  size_t index = 0, offset = 0;
+
+  if (!wait_rdy()) {
+    return XFER_ERR_TIMEOUT;
+  }
+
+  while (sent < length) {
+    size_t count = length - sent;
+    if (count > m_burst) { count = m_burst; }
+
+    for (size_t i = 0; i < count; i++) {
+      messages[i].tx_buf = next_tx_byte(segments, index, offset);
+      messages[i].rx_buf = read ? (unsigned long)(read + sent + i) : 0;
+      messages[i].len = 1;
+      messages[i].speed_hz = speed;
+      messages[i].delay_usecs = delay;
+      messages[i].bits_per_word = bits;
+      // Toggle CS between segments, the last one releases it anyway
+      messages[i].cs_change = (i + 1 < count);
+    }
+
+    uint64_t start = delay_now_ns();
+    int ret = m_transport->message(messages, count);
+    uint64_t end = delay_now_ns();
+    m_stats.ioctls.add(1);
+    m_stats.ioctl_ns.add(end - start);
+    trace(TRACE_IOCTL, start, end, count);
+    if (ret == -1) {
+      return XFER_ERR_IOCTL;
+    }
+    // The chip select edges strobe !WR in hardware
+    m_stats.strobes.add(count);
+    sent += count;
+
+    if (!handshake()) {
+      return XFER_ERR_TIMEOUT;
+    }
+  }
+
+  return sent;
+}
+
+// Starts a dedicated transmit thread that sends the frames handed to submit()
+// in order. depth is the number of frames that can be queued. A priority > 0
+// runs the thread as SCHED_FIFO at that priority, and cpu >= 0 pins it to
+// that core. buffers (2 or 3) is the number of present() back buffers.
+int SpiDevice::engine_start(int depth, int priority, int cpu, int buffers) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (priority > 0) {
+    struct sched_param param;
+    param.sched_priority = priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+
+  m_ring = new FrameRing<TxFrame *>(depth);
+  m_engine_stop = false;
+  m_present_buffers = buffers;
+  for (int i = 0; i < PRESENT_MAX_BUFFERS; i++) {
+    m_present[i].state = PRESENT_FREE;
+  }
+  int ret = pthread_create(&m_engine_thread, &attr, engine_main, this);
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0) {
+    delete m_ring;
+    m_ring = NULL;
+    return ret;
+  }
+  m_engine_running = true;
+
+#ifdef __linux__
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ret = pthread_setaffinity_np(m_engine_thread, sizeof(set), &set);
+    if (ret != 0) {
+      engine_stop();
+      return ret;
+    }
+  }
+#endif
+
+  return 0;
+}
+
+// Queues a copy of data. Returns false if the queue is full.
+bool SpiDevice::submit(const char *data, size_t length) {
+  TxFrame *frame = (TxFrame *)malloc(sizeof(TxFrame) + length);
+  if (!frame) { return false; }
+  frame->length = length;
+  memcpy(frame->data, data, length);
+
+  m_engine_queued_bytes += length;
+  if (!m_ring->push(frame)) {
+    m_engine_queued_bytes -= length;
+    free(frame);
+    return false;
+  }
+
+  pthread_mutex_lock(&m_engine_wait);
+  pthread_cond_signal(&m_engine_cond);
+  pthread_mutex_unlock(&m_engine_wait);
+  return true;
+}
+
+void SpiDevice::present(const uint8_t *frame) {
+  size_t size = m_framebuffer->size();
+
+  // With 3 buffers there is always a free one. With 2, the other one may
+  // hold a frame that never went out: it is stale, take it over.
+  pthread_mutex_lock(&m_engine_wait);
+  int slot = -1;
+  for (int i = 0; i < m_present_buffers && slot < 0; i++) {
+    if (m_present[i].state == PRESENT_FREE) { slot = i; }
+  }
+  for (int i = 0; i < m_present_buffers && slot < 0; i++) {
+    if (m_present[i].state == PRESENT_READY) {
+      slot = i;
+      m_present_dropped++;
+    }
+  }
+  m_present[slot].state = PRESENT_WRITING;
+  pthread_mutex_unlock(&m_engine_wait);
+
+  // No lock while copying, the engine never touches a WRITING slot
+  m_present[slot].frame.resize(size);
+  memcpy(&m_present[slot].frame[0], frame, size);
+
+  pthread_mutex_lock(&m_engine_wait);
+  for (int i = 0; i < m_present_buffers; i++) {
+    if (m_present[i].state == PRESENT_READY) {
+      m_present[i].state = PRESENT_FREE;
+      m_present_dropped++;
+    }
+  }
+  m_present[slot].state = PRESENT_READY;
+  m_present_frames++;
+  pthread_cond_signal(&m_engine_cond);
+  pthread_mutex_unlock(&m_engine_wait);
+}
+
+// Must be called with m_engine_wait held
+int SpiDevice::present_ready_slot() {
+  for (int i = 0; i < m_present_buffers; i++) {
+    if (m_present[i].state == PRESENT_READY) { return i; }
+  }
+  return -1;
+}
+
+// Engine thread: diff the frame against the shadow and send the changes,
+// under m_lock like commit(). A frame that fails half way leaves the display
+// torn: invalidate, so the next one is sent whole.
+void SpiDevice::present_send(int slot) {
+  pthread_mutex_lock(&m_lock);
+  m_composited = false;
+  size_t length = m_framebuffer->update(&m_present[slot].frame[0], bseries_commands(), m_present_buf);
+  int ret = 0;
+  if (length) {
+    TxSegment segment = { (const char *)&m_present_buf[0], length };
+    ret = locked_transfer(&segment, NULL, length);
+    if (ret < 0) { m_framebuffer->invalidate(); }
+  }
+  pthread_mutex_unlock(&m_lock);
+
+  if (ret < 0) {
+    m_present_torn++;
+    m_engine_errors++;
+  } else {
+    m_present_presented++;
+    m_engine_sent_bytes += ret;
+  }
+
+  pthread_mutex_lock(&m_engine_wait);
+  m_present[slot].state = PRESENT_FREE;
+  pthread_mutex_unlock(&m_engine_wait);
+}
+
+void *SpiDevice::engine_main(void *arg) {
+  static_cast<SpiDevice *>(arg)->engine_loop();
+  return NULL;
+}
+
+void SpiDevice::engine_loop() {
+  for (;;) {
+    TxFrame *frame;
+
+    // Submitted frames go first, then the newest presented one
+    if (!m_ring->pop(frame)) {
+      pthread_mutex_lock(&m_engine_wait);
+      int slot = present_ready_slot();
+      while (m_ring->size() == 0 && slot < 0 && !m_engine_stop) {
+        pthread_cond_wait(&m_engine_cond, &m_engine_wait);
+        slot = present_ready_slot();
+      }
+      if (slot >= 0) { m_present[slot].state = PRESENT_SENDING; }
+      bool done = m_engine_stop && m_ring->size() == 0 && slot < 0;
+      pthread_mutex_unlock(&m_engine_wait);
+
+      if (slot >= 0) { present_send(slot); }
+      if (done) { break; }
+      continue;
+    }
+
+    int ret = transfer(frame->data, NULL, frame->length);
+
+    if (ret < 0) {
+      m_engine_errors++;
+    } else {
+      m_engine_sent_frames++;
+      m_engine_sent_bytes += frame->length;
+    }
+    m_engine_queued_bytes -= frame->length;
+    free(frame);
+  }
+}
+
+void SpiDevice::engine_stop() {
+  if (!m_engine_running) { return; }
+
+  pthread_mutex_lock(&m_engine_wait);
+  m_engine_stop = true;
+  pthread_cond_signal(&m_engine_cond);
+  pthread_mutex_unlock(&m_engine_wait);
+
+  pthread_join(m_engine_thread, NULL);
+  delete m_ring;
+  m_ring = NULL;
+  m_engine_running = false;
+}
+
+// Polls RDY/BUSY for rdy_spin_ns(), which covers the usual per-byte busy
+// time, then sleeps on edge events of the line until the display is ready
+// or the RDY timeout is over. Returns false on timeout.
+bool
+SpiDevice::wait_rdy() {
+  uint64_t start = delay_now_ns();
+  uint64_t spin_until = start + rdy_spin_ns();
+  uint64_t deadline = m_rdy_timeout_ms ? start + m_rdy_timeout_ms * 1000000ULL : 0;
+  bool level = !m_invert_rdy;
+  bool ready = true;
+  bool blocked = false;
+
+  uint64_t now = start;
+  while (m_transport->pin_get(m_rdy_pin) != level) {
+    now = delay_now_ns();
+    if (deadline && now >= deadline) {
+      ready = false;
+      break;
+    }
+    if (now < spin_until) { continue; }
+
+    // Wait a second at a time without a deadline
+    uint64_t timeout = deadline ? deadline - now : 1000000000ULL;
+    int ret = m_transport->pin_wait(m_rdy_pin, level, timeout);
+    if (ret < 0) {
+      // No edge events, keep polling
+      spin_until = UINT64_MAX;
+      continue;
+    }
+    blocked = true;
+    if (ret > 0) { break; }
+  }
+
+  uint64_t end = delay_now_ns();
+  m_stats.rdy_wait_ns.add(end - start);
+  if (blocked) { m_stats.rdy_blocks.add(1); }
+  if (!ready) { m_stats.rdy_timeouts.add(1); }
+  trace(TRACE_RDY, start, end, 0);
+  return ready;
+}
+
+int64_t SpiDevice::measure_rdy_lag(uint64_t window_ns) {
+  pthread_mutex_lock(&m_lock);
+  if (!m_open) {
+    pthread_mutex_unlock(&m_lock);
+    return XFER_ERR_CLOSED;
+  }
+  if (!m_rdy_pin) {
+    pthread_mutex_unlock(&m_lock);
+    return 0;
+  }
+  m_commands.forget();
+
+  char nul = 0;
+  struct spi_ioc_transfer data;
+  memset(&data, 0, sizeof(data));
+  data.tx_buf = (unsigned long)&nul;
+  data.len = 1;
+  data.speed_hz = m_max_speed;
+  data.delay_usecs = m_delay;
+  data.bits_per_word = m_bits_per_word;
+
+  if (m_transport->message(&data, 1) == -1) {
+    pthread_mutex_unlock(&m_lock);
+    return XFER_ERR_IOCTL;
+  }
+  if (m_wr_pin && !m_cs_strobe) {
+    m_transport->pin_clr(m_wr_pin);
+    m_transport->pin_set(m_wr_pin);
+  }
+
+  uint64_t strobed_at = delay_now_ns();
+  int64_t lag = 0;
+  for (;;) {
+    uint64_t now = delay_now_ns();
+    if (!rdy_asserted()) {
+      lag = (now > strobed_at) ? now - strobed_at : 1;
+      break;
+    }
+    if (now - strobed_at > window_ns) { break; }
+  }
+
+  bool ready = wait_rdy();
+  pthread_mutex_unlock(&m_lock);
+  return ready ? lag : XFER_ERR_TIMEOUT;
+}
+
+// Wait for the display to take the byte we just strobed in. Returns false on
+// RDY timeout.
+bool
+SpiDevice::handshake() {
+  uint32_t settle = settle_ns();
+  uint64_t start = m_trace ? delay_now_ns() : 0;
+  delay_ns(settle);
+  if (m_trace) { trace(TRACE_SETTLE, start, delay_now_ns(), 0); }
+  m_stats.settles.add(1);
+  m_stats.settle_ns.add(settle);
+  return wait_rdy();
+}
+
+uint32_t
+SpiDevice::settle_ns() const {
+  if (m_settle_ns) { return m_settle_ns; }
+
+  if (m_invert_rdy) {
+    //For Series 7000 displays, the busy pin (spec says 20us max!)
+    // can take a while to go up, so we have to add this delay. 10us
+    // works well in practice.
+    return SETTLE_NS_7000;
+  }
+  // The RDY line can take up to 500ns to do down,
+  // so we need to wait before reading it:
+  return SETTLE_NS_3900;
+}
+
+uint32_t
+SpiDevice::rdy_spin_ns() const {
+  if (m_rdy_spin_ns) { return m_rdy_spin_ns; }
+  return m_invert_rdy ? SPIN_NS_7000 : SPIN_NS_3900;
+}
+
+bool
+SpiDevice::rdy_asserted() {
+  if (m_invert_rdy) {
+    return !m_transport->pin_get(m_rdy_pin);
+  }
+  return m_transport->pin_get(m_rdy_pin);
+}
@@ -0,0 +1,251 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <string>
+
+#include "frame_ring.h"
+#include "transport.h"
+#include "sim_transport.h"
+#include "framebuffer.h"
+#include "compositor.h"
+#include "stats.h"
+#include "trace.h"
+#include "command_queue.h"
+
+// full_duplex_transfer() returns the number of bytes sent, or one of these
+#define XFER_ERR_IOCTL   -1   // ioctl(SPI_IOC_MESSAGE) failed
+#define XFER_ERR_CLOSED  -2   // device was closed before the transfer ran
+#define XFER_ERR_TIMEOUT -3   // RDY stayed down longer than rdyTimeout
+#define XFER_ERR_RESIZED -4   // framebuffer() changed the size before a commit ran
+
+#define MAX_BURST 256
+
+// Default wait between the !WR strobe and the first RDY/BUSY read
+#define SETTLE_NS_3900   1000
+#define SETTLE_NS_7000  10000
+
+// Default time wait_rdy() polls RDY/BUSY before it sleeps on an edge event.
+// Longer on the 7000 series, where BUSY lasts about 20us per byte.
+#define SPIN_NS_3900    20000
+#define SPIN_NS_7000    50000
+
+#define RDY_TIMEOUT_MS   1000
+
+// Back buffers for present(): at most one frame being sent, one waiting
+#define PRESENT_MAX_BUFFERS 3
+
+enum PresentState {
+  PRESENT_FREE,
+  PRESENT_WRITING,   // present() is copying a frame in
+  PRESENT_READY,     // newest complete frame, not sent yet
+  PRESENT_SENDING    // the transmit engine owns it
+};
+
+struct PresentSlot {
+  PresentState state;
+  std::vector<uint8_t> frame;
+};
+
+// A buffer submitted to the transmit engine, copied out of the JS heap so
+// the transmit thread never has to touch V8.
+struct TxFrame {
+  size_t length;
+  char data[1];
+};
+
+// One piece of a gathered write, see transferv(). NULL data sends zeros.
+struct TxSegment {
+  const char *data;
+  size_t length;
+};
+
+// The display link without any V8 in it: settings, transport, the transfer
+// loop and the transmit engine. Spi wraps this for JS, the benchmark uses it
+// directly. Everything here can run on any thread.
+class SpiDevice {
+    public:
+        SpiDevice();
+        virtual ~SpiDevice();
+
+        // Returns NULL on success, or an error message
+        const char *open(const char *device);
+        const char *set_transport(const char *name);
+        void close();
+
+        // Takes m_lock for the duration of the transfer. write or read may
+        // be NULL.
+        int transfer(char *write, char *read, size_t length);
+        // Sends the segments back to back as one transfer, with the same
+        // handshake and burst accounting as a single buffer
+        int transferv(const TxSegment *segments, size_t count);
+
+        // Command queue: small writes collected and sent as one transfer by
+        // flush(), see command_queue.h
+        void queue_command(const uint8_t *data, size_t length);
+        int flush();
+        static const char *transfer_error(int code);
+
+        // Returns 0 or an errno value
+        int engine_start(int depth, int priority, int cpu, int buffers);
+        void engine_stop();
+        bool submit(const char *data, size_t length);
+
+        // Hands a whole framebuffer frame to the transmit engine, which sends
+        // what changed since the last frame it sent. Returns right away; a
+        // frame that was still waiting to be sent is dropped.
+        void present(const uint8_t *frame);
+
+        // Shadow framebuffer. commit() sends only what changed since the
+        // last commit and returns the bytes sent, 0 if nothing changed, or
+        // an XFER_ERR code. A failed commit invalidates the shadow. The
+        // second form can run on any thread: it encodes into out and fails
+        // if size no longer matches the framebuffer. changed, for a frame
+        // from the compositor, flags the columns changed since the last one.
+        const char *set_framebuffer(uint32_t width, uint32_t height);
+        int commit(const uint8_t *frame);
+        int commit(const uint8_t *frame, size_t size, std::vector<uint8_t> &out,
+                   const uint8_t *changed = NULL);
+        void invalidate();
+
+        // Layer compositor over the framebuffer, created with it, see
+        // compositor.h. compose_layers() rebuilds the dirty columns and
+        // returns how many changed; m_changed flags the columns changed since
+        // the last commit_layers(). commit_layers() composes and sends what
+        // changed, like commit(). Only the flagged columns are diffed, unless
+        // the shadow came from commit() or present().
+        uint32_t compose_layers();
+        int commit_layers();
+
+        // Display geometry for the encoders: the framebuffer size if one is
+        // set, 256x128 otherwise
+        uint32_t display_width() const;
+        uint32_t display_rows() const;
+        bool bseries_commands() const { return m_bseries || m_invert_rdy; }
+
+        // Encode a Graphic DMA write and send it, see ntk_encoder.h.
+        // Return the bytes sent or an XFER_ERR code.
+        int write_bit_image(uint16_t address, const uint8_t *data, uint16_t size);
+        int write_window(uint32_t x, uint32_t row, uint32_t width, uint32_t rows, const uint8_t *data);
+
+        // Strobes in a NUL, which displays ignore, and polls RDY/BUSY without
+        // settling first. Returns the ns until the line showed the display
+        // busy, 0 if it did not within window_ns, or an XFER_ERR code. Used
+        // by autotune() to measure how late the line moves.
+        int64_t measure_rdy_lag(uint64_t window_ns);
+
+        bool m_open;
+        uint32_t m_mode;
+        uint32_t m_max_speed;
+        uint16_t m_delay;
+        uint8_t m_bits_per_word;
+        uint32_t m_wr_pin;
+        uint32_t m_rdy_pin;
+        bool m_cs_strobe;
+        bool m_bseries;
+        bool m_invert_rdy;
+        uint32_t m_burst;
+        uint32_t m_settle_ns;   // 0 picks the series default
+        uint32_t m_rdy_spin_ns; // 0 picks the series default
+        uint32_t m_rdy_timeout_ms;   // 0 waits forever
+        uint32_t m_data_pins[8];     // D0..D7 for the parallel transport
+
+        uint32_t settle_ns() const;
+        uint32_t rdy_spin_ns() const;
+
+        // Serializes access to the device between the JS thread, the
+        // libuv thread pool and the transmit engine.
+        pthread_mutex_t m_lock;
+
+        // Transmit engine: one thread draining a ring of submitted frames
+        FrameRing<TxFrame *> *m_ring;
+        pthread_t m_engine_thread;
+        bool m_engine_running;            // owner thread only
+        bool m_engine_stop;               // guarded by m_engine_wait
+        pthread_mutex_t m_engine_wait;
+        pthread_cond_t m_engine_cond;
+        std::atomic<uint64_t> m_engine_queued_bytes;
+        std::atomic<uint64_t> m_engine_sent_frames;
+        std::atomic<uint64_t> m_engine_sent_bytes;
+        std::atomic<uint64_t> m_engine_errors;
+
+        // Presentation, guarded by m_engine_wait. Once the engine runs, the
+        // framebuffer shadow belongs to the engine thread.
+        int m_present_buffers;
+        PresentSlot m_present[PRESENT_MAX_BUFFERS];
+        std::vector<uint8_t> m_present_buf;   // engine thread only
+        std::atomic<uint64_t> m_present_frames;
+        std::atomic<uint64_t> m_present_presented;
+        std::atomic<uint64_t> m_present_dropped;
+        std::atomic<uint64_t> m_present_torn;
+
+        // Byte at a time sending for the interleaving scheduler, see
+        // scheduler.h. Must be called with m_lock held.
+        void interleave_begin();
+        bool interleave_ready(uint64_t now);
+        bool interleave_stalled(uint64_t now) const;
+        int interleave_send(const char *byte);
+        void interleave_end(int result, uint64_t start, uint64_t end);
+        uint64_t m_ready_at;   // no RDY read before, the settle time
+
+        // Written under m_lock, readable from any thread
+        TransferStats m_stats;
+        void reset_stats();
+
+        // Event trace, off (NULL) unless enabled. Guarded by m_lock.
+        TraceBuffer *m_trace;
+        void set_trace(size_t capacity);
+        bool trace_json(int pid, std::string &json);
+
+        // SPI and GPIO access. m_sim is set when m_transport is the simulator.
+        Transport *m_transport;
+        SimTransport *m_sim;
+
+        // The shadow is replaced and updated under m_lock, by every thread
+        Framebuffer *m_framebuffer;
+        Compositor *m_compositor;
+        bool m_composited;                   // the shadow is the composed frame
+        std::vector<uint8_t> m_changed;      // per column, from compose()
+        std::vector<uint8_t> m_encode_buf;   // JS thread only
+
+        // Guarded by m_lock
+        CommandQueue m_commands;
+        std::vector<uint8_t> m_flush_buf;
+
+    protected:
+        // Must be called with m_lock held
+        int locked_transfer(const TxSegment *segments, char *read, size_t length);
+        int full_duplex_transfer(const TxSegment *segments, char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits);
+        int cs_strobe_transfer(const TxSegment *segments, char *read, size_t length, uint32_t speed, uint16_t delay, uint8_t bits);
+        bool wait_rdy();
+        bool handshake();
+        bool rdy_asserted();
+
+        void trace(TraceEventType type, uint64_t start_ns, uint64_t end_ns, uint32_t arg) {
+          if (m_trace) { m_trace->record(type, start_ns, end_ns, arg); }
+        }
+
+        static void *engine_main(void *arg);
+        void engine_loop();
+        int present_ready_slot();
+        void present_send(int slot);
+};
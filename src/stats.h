@@ -0,0 +1,116 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Always-on transfer statistics. Writers hold the device lock, so updates
+// are plain relaxed load/store pairs, no locked read-modify-write; readers
+// on other threads see each value whole, if not all of them at the same
+// instant.
+
+#define STATS_BUCKETS 40
+
+class StatCounter {
+    public:
+        StatCounter() : m_value(0) {}
+
+        void add(uint64_t v) {
+          m_value.store(m_value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+        void raise(uint64_t v) {
+          if (v > m_value.load(std::memory_order_relaxed)) {
+            m_value.store(v, std::memory_order_relaxed);
+          }
+        }
+        uint64_t get() const { return m_value.load(std::memory_order_relaxed); }
+        void reset() { m_value.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> m_value;
+};
+
+// Log2 histogram: bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i),
+// the last bucket everything above.
+class StatHistogram {
+    public:
+        void add(uint64_t v) {
+          int bucket = v ? 64 - __builtin_clzll(v) : 0;
+          if (bucket >= STATS_BUCKETS) { bucket = STATS_BUCKETS - 1; }
+          m_buckets[bucket].add(1);
+          m_count.add(1);
+          m_sum.add(v);
+          m_max.raise(v);
+        }
+
+        void reset() {
+          for (int i = 0; i < STATS_BUCKETS; i++) { m_buckets[i].reset(); }
+          m_count.reset();
+          m_sum.reset();
+          m_max.reset();
+        }
+
+        uint64_t bucket(int i) const { return m_buckets[i].get(); }
+        uint64_t count() const { return m_count.get(); }
+        uint64_t sum() const { return m_sum.get(); }
+        uint64_t max() const { return m_max.get(); }
+
+    private:
+        StatCounter m_buckets[STATS_BUCKETS];
+        StatCounter m_count;
+        StatCounter m_sum;
+        StatCounter m_max;
+};
+
+struct TransferStats {
+  StatCounter transfers;
+  StatCounter bytes;
+  StatCounter errors;
+  StatCounter ioctls;
+  StatCounter strobes;
+  StatCounter strobe_ns;
+  StatCounter settles;
+  StatCounter settle_ns;
+  StatCounter rdy_blocks;         // waits that slept on an edge event
+  StatCounter rdy_timeouts;
+  StatCounter commands_queued;
+  StatCounter commands_dropped;   // redundant state commands left out
+  StatHistogram ioctl_ns;
+  StatHistogram rdy_wait_ns;      // the max is the longest stall
+  StatHistogram transfer_ns;
+  StatHistogram bytes_per_sec;    // one sample per transfer
+
+  void reset() {
+    transfers.reset();
+    bytes.reset();
+    errors.reset();
+    ioctls.reset();
+    strobes.reset();
+    strobe_ns.reset();
+    settles.reset();
+    settle_ns.reset();
+    rdy_blocks.reset();
+    rdy_timeouts.reset();
+    commands_queued.reset();
+    commands_dropped.reset();
+    ioctl_ns.reset();
+    rdy_wait_ns.reset();
+    transfer_ns.reset();
+    bytes_per_sec.reset();
+  }
+};
@@ -0,0 +1,77 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+static const char *trace_names[] = { "transfer", "ioctl", "wr", "settle", "rdy" };
+
+// Threads get ids in the order they first record something
+static uint16_t trace_thread_id() {
+  static __thread uint16_t id = 0;
+  static uint16_t next = 0;
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+  if (!id) {
+    pthread_mutex_lock(&lock);
+    id = ++next;
+    pthread_mutex_unlock(&lock);
+  }
+  return id;
+}
+
+TraceBuffer::TraceBuffer(size_t capacity) :
+        m_records(capacity),
+        m_count(0) {
+}
+
+void TraceBuffer::record(TraceEventType type, uint64_t start_ns, uint64_t end_ns, uint32_t arg) {
+  TraceRecord &r = m_records[m_count % m_records.size()];
+  r.start_ns = start_ns;
+  r.duration_ns = end_ns - start_ns;
+  r.type = type;
+  r.thread = trace_thread_id();
+  r.arg = arg;
+  m_count++;
+}
+
+std::string TraceBuffer::chrome_json(int pid) const {
+  std::string json = "{\"traceEvents\":[";
+  char line[256];
+
+  size_t count = size();
+  uint64_t first = m_count - count;
+  for (size_t i = 0; i < count; i++) {
+    const TraceRecord &r = m_records[(first + i) % m_records.size()];
+    // Complete events, microseconds
+    int length = snprintf(line, sizeof(line),
+        "%s\n{\"name\":\"%s\",\"cat\":\"spi\",\"ph\":\"X\",\"ts\":%llu.%03u,\"dur\":%llu.%03u,"
+        "\"pid\":%d,\"tid\":%u,\"args\":{\"bytes\":%u}}",
+        i ? "," : "",
+        trace_names[r.type],
+        (unsigned long long)(r.start_ns / 1000), (unsigned)(r.start_ns % 1000),
+        (unsigned long long)(r.duration_ns / 1000), (unsigned)(r.duration_ns % 1000),
+        pid, r.thread, r.arg);
+    json.append(line, length);
+  }
+
+  snprintf(line, sizeof(line), "\n],\"otherData\":{\"lostEvents\":%llu}}\n",
+           (unsigned long long)lost());
+  json.append(line);
+  return json;
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Opt-in event trace: one record per transfer, ioctl, !WR pulse, settle
+// delay and RDY wait, kept in a ring allocated up front that overwrites the
+// oldest records. Writers hold the device lock. Timestamps come from
+// CLOCK_MONOTONIC, the clock behind process.hrtime() and Node's own trace
+// events.
+
+enum TraceEventType {
+  TRACE_TRANSFER,
+  TRACE_IOCTL,
+  TRACE_STROBE,
+  TRACE_SETTLE,
+  TRACE_RDY
+};
+
+struct TraceRecord {
+  uint64_t start_ns;
+  uint64_t duration_ns;   // a RDY wait with no timeout can run for seconds
+  uint16_t type;
+  uint16_t thread;   // small id of the recording thread
+  uint32_t arg;      // bytes for transfers and ioctls
+};
+
+class TraceBuffer {
+    public:
+        explicit TraceBuffer(size_t capacity);
+
+        void record(TraceEventType type, uint64_t start_ns, uint64_t end_ns, uint32_t arg);
+
+        size_t size() const { return m_count < m_records.size() ? m_count : m_records.size(); }
+        uint64_t lost() const { return m_count > m_records.size() ? m_count - m_records.size() : 0; }
+
+        // Chrome trace / Perfetto JSON document, oldest record first
+        std::string chrome_json(int pid) const;
+
+    private:
+        std::vector<TraceRecord> m_records;
+        uint64_t m_count;
+};
@@ -0,0 +1,330 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "transport.h"
+#include "bcm2708.h"
+#include "delay.h"
+#include "gpio_map.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+
+#ifdef __linux__
+  #include <sys/ioctl.h>
+  #include <linux/gpio.h>
+#endif
+
+const char *SpidevTransport::open(const char *device, const LinkConfig &config) {
+  uint32_t mode = config.mode;
+  uint8_t bits = config.bits_per_word;
+  uint32_t speed = config.max_speed;
+
+  m_fd = ::open(device, O_RDWR); // Blocking!
+  if (m_fd < 0) {
+    return "Unable to open device";
+  }
+
+  if (ioctl(m_fd, SPI_IOC_WR_MODE, &mode) == -1) {
+    close();
+    return "Unable to set SPI_IOC_WR_MODE";
+  }
+  if (ioctl(m_fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1) {
+    close();
+    return "Unable to set SPI_IOC_WR_BITS_PER_WORD";
+  }
+  if (ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1) {
+    close();
+    return "Unable to set SPI_IOC_WR_MAX_SPEED_HZ";
+  }
+
+  const char *error = open_pins(config);
+  if (error) {
+    close();
+    return error;
+  }
+
+  return NULL;
+}
+
+void SpidevTransport::close() {
+  close_pins();
+  if (m_fd != -1) {
+    ::close(m_fd);
+    m_fd = -1;
+  }
+}
+
+int SpidevTransport::message(struct spi_ioc_transfer *segments, unsigned count) {
+  return ioctl(m_fd, SPI_IOC_MESSAGE(count), segments);
+}
+
+// SPI0 pins: CE1, CE0, MISO, MOSI, SCLK
+#define SPI0_FIRST_PIN 7
+#define SPI0_LAST_PIN  11
+
+// What the SPI0 pins were set to before the first spi0 display took them,
+// put back when the last one closes. Guarded by gpio_config_lock().
+static int spi0_pin_users = 0;
+static unsigned spi0_saved_fsel[SPI0_LAST_PIN - SPI0_FIRST_PIN + 1];
+
+const char *Spi0Transport::open(const char *device, const LinkConfig &config) {
+  if (config.bits_per_word != 8) {
+    return "The spi0 transport only sends 8 bit words";
+  }
+
+  uint32_t chip_select = 0;
+  const char *dot = strrchr(device, '.');
+  if (dot && dot[1] >= '0' && dot[1] <= '1' && !dot[2]) {
+    chip_select = dot[1] - '0';
+  }
+  // CE2 is not brought out: nothing gets selected
+  if (config.mode & SPI_NO_CS) { chip_select = 2; }
+
+  const char *error = NULL;
+  m_spi0 = spi0_acquire(&error);
+  if (!m_spi0) { return error; }
+
+  error = open_pins(config);
+  if (error) {
+    close();
+    return error;
+  }
+
+  gpio_config_lock();
+  if (spi0_pin_users++ == 0) {
+    for (int pin = SPI0_FIRST_PIN; pin <= SPI0_LAST_PIN; pin++) {
+      spi0_saved_fsel[pin - SPI0_FIRST_PIN] = GET_GPIO_FSEL(pin);
+      INP_GPIO(pin);
+      SET_GPIO_ALT(pin, 0);
+    }
+  }
+  m_pins_taken = true;
+  gpio_config_unlock();
+
+  m_registers = new MappedRegisters(m_spi0);
+  m_fifo = new Spi0Fifo(*m_registers);
+  m_fifo->setup(chip_select, config.mode);
+  return NULL;
+}
+
+void Spi0Transport::close() {
+  if (m_fifo) {
+    m_fifo->release();
+    delete m_fifo;
+    m_fifo = NULL;
+  }
+  delete m_registers;
+  m_registers = NULL;
+  if (m_spi0) {
+    spi0_release();
+    m_spi0 = NULL;
+  }
+  // Hand the pins back to whatever had them, spidev usually
+  if (m_pins_taken) {
+    gpio_config_lock();
+    if (--spi0_pin_users == 0) {
+      for (int pin = SPI0_FIRST_PIN; pin <= SPI0_LAST_PIN; pin++) {
+        SET_GPIO_FSEL(pin, spi0_saved_fsel[pin - SPI0_FIRST_PIN]);
+      }
+    }
+    gpio_config_unlock();
+    m_pins_taken = false;
+  }
+  close_pins();
+}
+
+int Spi0Transport::message(struct spi_ioc_transfer *segments, unsigned count) {
+  if (!m_fifo) { return -1; }
+  return m_fifo->message(segments, count);
+}
+
+const char *ParallelTransport::open(const char *device, const LinkConfig &config) {
+  if (config.cs_strobe) {
+    return "csStrobe needs the spidev transport";
+  }
+
+  // Pins are bits of the GPSET0/GPCLR0 words: check the range before
+  // shifting by them
+  if (config.wr_pin > 31 || config.rdy_pin > 31) {
+    return "WR and RDY must be GPIOs below 32 for the parallel transport";
+  }
+  uint32_t used = (1u << config.wr_pin) | (1u << config.rdy_pin);
+  for (int i = 0; i < 8; i++) {
+    if (config.data_pins[i] > 31 || (used & (1u << config.data_pins[i]))) {
+      return "Data pins must be 8 different GPIOs below 32, not WR or RDY";
+    }
+    used |= 1u << config.data_pins[i];
+  }
+
+  for (int value = 0; value < 256; value++) {
+    m_set[value] = 0;
+    m_clr[value] = 0;
+    for (int bit = 0; bit < 8; bit++) {
+      uint32_t pin = 1u << config.data_pins[bit];
+      if (value & (1 << bit)) {
+        m_set[value] |= pin;
+      } else {
+        m_clr[value] |= pin;
+      }
+    }
+  }
+
+  const char *error = open_pins(config);
+  if (error) { return error; }
+
+  gpio_config_lock();
+  for (int i = 0; i < 8; i++) {
+    INP_GPIO(config.data_pins[i]);
+    OUT_GPIO(config.data_pins[i]);
+  }
+  gpio_config_unlock();
+
+  return NULL;
+}
+
+void ParallelTransport::close() {
+  close_pins();
+}
+
+int ParallelTransport::message(struct spi_ioc_transfer *segments, unsigned count) {
+  if (!gpio) { return -1; }
+
+  int total = 0;
+  for (unsigned i = 0; i < count; i++) {
+    struct spi_ioc_transfer &segment = segments[i];
+    const uint8_t *tx = (const uint8_t *)(uintptr_t)segment.tx_buf;
+    uint8_t *rx = (uint8_t *)(uintptr_t)segment.rx_buf;
+
+    for (uint32_t j = 0; j < segment.len; j++) {
+      uint8_t byte = tx ? tx[j] : 0;
+      GPIO_CLR = m_clr[byte];
+      GPIO_SET = m_set[byte];
+    }
+    if (rx) { memset(rx, 0, segment.len); }
+    if (segment.delay_usecs) { delay_ns(segment.delay_usecs * 1000); }
+    total += segment.len;
+  }
+  return total;
+}
+
+// Setup the GPIO pins, on the mapping shared by all displays
+const char *GpioTransport::open_pins(const LinkConfig &config) {
+  const char *error = NULL;
+  gpio = gpio_acquire(&error);
+  if (!gpio) {
+    return error;
+  }
+
+   printf("Ready pin: %u", config.rdy_pin);
+ 
+   gpio_config_lock();
+
+   // With csStrobe, !WR is driven by the chip select line
+   if (!config.cs_strobe) {
+     INP_GPIO(config.wr_pin);
+     OUT_GPIO(config.wr_pin);
+   }
+
+   INP_GPIO(config.rdy_pin);
+   // Enable pulldown on Ready pin:
+   GPIO_PULL = 1;
+   delay_ns(5000);
+   GPIO_PULLCLK0 = 1 << config.rdy_pin;
+   delay_ns(5000);
+   GPIO_PULL = 0;
+   GPIO_PULLCLK0 = 0;   
+
+   gpio_config_unlock();
+
+#ifdef GPIO_GET_LINEEVENT_IOCTL
+  // Ask for RDY edge events, so that long waits can sleep. Without them,
+  // wait_rdy() keeps polling.
+  int chip_fd = ::open("/dev/gpiochip0", O_RDONLY);
+  if (chip_fd >= 0) {
+    struct gpioevent_request request;
+    memset(&request, 0, sizeof(request));
+    request.lineoffset = config.rdy_pin;
+    request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+    request.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+    strncpy(request.consumer_label, "ntk3900-rdy", sizeof(request.consumer_label) - 1);
+
+    if (ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &request) == 0) {
+      m_event_fd = request.fd;
+      m_event_pin = config.rdy_pin;
+      fcntl(m_event_fd, F_SETFL, fcntl(m_event_fd, F_GETFL) | O_NONBLOCK);
+    }
+    ::close(chip_fd);
+  }
+#endif
+
+  return NULL;
+}
+
+void GpioTransport::close_pins() {
+  if (m_event_fd != -1) {
+    ::close(m_event_fd);
+    m_event_fd = -1;
+  }
+  if (gpio) {
+    gpio_release();
+    gpio = NULL;
+  }
+}
+
+void GpioTransport::pin_set(uint32_t pin) {
+  GPIO_SET = 1 << pin;
+}
+
+void GpioTransport::pin_clr(uint32_t pin) {
+  GPIO_CLR = 1 << pin;
+}
+
+bool GpioTransport::pin_get(uint32_t pin) {
+  return GET_GPIO(pin) != 0;
+}
+
+// Edges we already know about, the level is read from the registers anyway
+void GpioTransport::drain_events() {
+#ifdef GPIO_GET_LINEEVENT_IOCTL
+  struct gpioevent_data events[16];
+  while (read(m_event_fd, events, sizeof(events)) > 0) {}
+#endif
+}
+
+int GpioTransport::pin_wait(uint32_t pin, bool level, uint64_t timeout_ns) {
+  if (m_event_fd == -1 || pin != m_event_pin) { return -1; }
+
+  // Events queued before this point are stale. Drop them, then look at the
+  // line: an edge after the read still wakes the poll below.
+  drain_events();
+  if (pin_get(pin) == level) { return 1; }
+
+  struct pollfd fd = { m_event_fd, POLLIN | POLLPRI, 0 };
+  struct timespec timeout;
+  timeout.tv_sec = timeout_ns / 1000000000ULL;
+  timeout.tv_nsec = timeout_ns % 1000000000ULL;
+  if (ppoll(&fd, 1, &timeout, NULL) < 0 && errno != EINTR) {
+    return -1;
+  }
+
+  drain_events();
+  return pin_get(pin) == level ? 1 : 0;
+}
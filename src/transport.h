@@ -0,0 +1,156 @@
+/*
+    Copyright (c) 2012, Russell Hay <me@russellhay.com>
+
+    Permission to use, copy, modify, and/or distribute this software for any
+    purpose with or without fee is hereby granted, provided that the above
+    copyright notice and this permission notice appear in all copies.
+
+    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __linux__
+  #include <linux/spi/spidev.h>
+#else
+  #include "fake_spi.h"
+#endif
+
+#include "spi0.h"
+
+// Everything a transport needs to know about the wiring when it is opened
+struct LinkConfig {
+  uint32_t mode;
+  uint8_t bits_per_word;
+  uint32_t max_speed;
+  uint32_t wr_pin;
+  uint32_t rdy_pin;
+  bool invert_rdy;     // 7000 series BUSY instead of RDY
+  bool bseries;        // 7000/B-series command set
+  bool cs_strobe;      // chip select drives !WR, wr_pin is unused
+  uint32_t data_pins[8];   // parallel transport: D0..D7
+};
+
+// How Spi talks to the SPI controller and the WR/RDY lines. The default is
+// spidev plus the memory mapped GPIO block, but the same transfer code can
+// run against a simulated display.
+class Transport {
+    public:
+        virtual ~Transport() {}
+
+        // As selected with Spi.transport()
+        virtual const char *name() const = 0;
+
+        // Returns NULL on success, or an error message
+        virtual const char *open(const char *device, const LinkConfig &config) = 0;
+        virtual void close() = 0;
+
+        // Same contract as ioctl(fd, SPI_IOC_MESSAGE(count), segments)
+        virtual int message(struct spi_ioc_transfer *segments, unsigned count) = 0;
+
+        virtual void pin_set(uint32_t pin) = 0;
+        virtual void pin_clr(uint32_t pin) = 0;
+        virtual bool pin_get(uint32_t pin) = 0;
+
+        // Sleeps until pin reads level or timeout_ns is over, woken by edge
+        // events where the transport has them. Returns 1 once the pin reads
+        // level, 0 otherwise, or -1 if the transport cannot wait: poll
+        // pin_get() instead.
+        virtual int pin_wait(uint32_t pin, bool level, uint64_t timeout_ns) { return -1; }
+};
+
+// WR/RDY through the /dev/mem mapped GPIO registers, the part the real
+// transports share
+class GpioTransport : public Transport {
+    public:
+        GpioTransport() : gpio(NULL), m_event_fd(-1), m_event_pin(0) {}
+
+        void pin_set(uint32_t pin);
+        void pin_clr(uint32_t pin);
+        bool pin_get(uint32_t pin);
+        int pin_wait(uint32_t pin, bool level, uint64_t timeout_ns);
+
+    protected:
+        // Maps the GPIO block and sets up WR (unless csStrobe) and RDY.
+        // Returns NULL on success, or an error message.
+        const char *open_pins(const LinkConfig &config);
+        void close_pins();
+
+        // I/O access, named so the bcm2708.h macros work. Shared, see
+        // gpio_map.h.
+        volatile unsigned *gpio;
+
+    private:
+        void drain_events();
+
+        // Edge events of the RDY line from /dev/gpiochip0, -1 if the kernel
+        // does not have the GPIO character device
+        int m_event_fd;
+        uint32_t m_event_pin;
+};
+
+// /dev/spidevX.Y for the data, through the 74HC595
+class SpidevTransport : public GpioTransport {
+    public:
+        SpidevTransport() : m_fd(-1) {}
+        ~SpidevTransport() { close(); }
+
+        const char *name() const { return "spidev"; }
+        const char *open(const char *device, const LinkConfig &config);
+        void close();
+        int message(struct spi_ioc_transfer *segments, unsigned count);
+
+    private:
+        int m_fd;
+};
+
+// The SPI0 controller driven from userspace through its mapped registers:
+// bytes go straight into the controller FIFO, without an ioctl per byte.
+// The kernel SPI driver must not use the controller at the same time. The
+// chip select comes from the device path, /dev/spidev0.1 selects CE1.
+class Spi0Transport : public GpioTransport {
+    public:
+        Spi0Transport() : m_spi0(NULL), m_registers(NULL), m_fifo(NULL), m_pins_taken(false) {}
+        ~Spi0Transport() { close(); }
+
+        const char *name() const { return "spi0"; }
+        const char *open(const char *device, const LinkConfig &config);
+        void close();
+        int message(struct spi_ioc_transfer *segments, unsigned count);
+
+    private:
+        volatile unsigned *m_spi0;
+        MappedRegisters *m_registers;
+        Spi0Fifo *m_fifo;
+        bool m_pins_taken;   // counted in the GPIO 7-11 users, see open()
+};
+
+// The 8 data lines driven straight from GPIO pins, for boards with enough
+// of them free: no spidev, no 74HC595 and no syscall per byte. message()
+// puts each byte on the pins with one GPIO_CLR and one GPIO_SET write, the
+// transfer loop strobes WR as usual. Nothing is read back, rx buffers are
+// zeroed. The device path is ignored.
+class ParallelTransport : public GpioTransport {
+    public:
+        ParallelTransport() {}
+        ~ParallelTransport() { close(); }
+
+        const char *name() const { return "parallel"; }
+        const char *open(const char *device, const LinkConfig &config);
+        void close();
+        int message(struct spi_ioc_transfer *segments, unsigned count);
+
+    private:
+        // GPIO_SET and GPIO_CLR masks for every byte value
+        uint32_t m_set[256];
+        uint32_t m_clr[256];
+};